@@ -90,6 +90,24 @@ inline void Epoche::markNodeForDeletion(void *n, ThreadInfo &epocheInfo)
     epocheInfo.getDeletionList().thresholdCounter++;
 }
 
+inline void Epoche::markRecordForDeletion(void *record, ThreadInfo &epocheInfo)
+{
+    markNodeForDeletion((void *)((uintptr_t)record | recordTag), epocheInfo);
+}
+
+inline void Epoche::reclaim(void *n)
+{
+    if ((uintptr_t)n & recordTag)
+    {
+        reclaimer->release((void *)((uintptr_t)n ^ recordTag));
+        return;
+    }
+    //operator delete(n);
+    freedNodes.fetch_add(1, std::memory_order_release);
+    PMEMoid free_objs = pmemobj_oid(n);
+    pmemobj_free(&free_objs);
+}
+
 inline void Epoche::exitEpocheAndCleanup(ThreadInfo &epocheInfo)
 {
     DeletionList &deletionList = epocheInfo.getDeletionList();
@@ -115,7 +133,6 @@ inline void Epoche::exitEpocheAndCleanup(ThreadInfo &epocheInfo)
                 oldestEpoche = e;
             }
         }
-        PMEMoid free_objs;
         LabelDelete *cur = deletionList.head(), *next, *prev = nullptr;
         while (cur != nullptr)
         {
@@ -124,11 +141,7 @@ inline void Epoche::exitEpocheAndCleanup(ThreadInfo &epocheInfo)
             if (cur->epoche < oldestEpoche)
             {
                 for (std::size_t i = 0; i < cur->nodesCount; ++i)
-                {
-                    //operator delete(cur->nodes[i]);
-                    free_objs = pmemobj_oid(cur->nodes[i]);
-                    pmemobj_free(&free_objs);
-                }
+                    reclaim(cur->nodes[i]);
                 deletionList.remove(cur, prev);
             }
             else
@@ -155,18 +168,13 @@ inline Epoche::~Epoche()
     for (auto &d : deletionLists)
     {
         LabelDelete *cur = d.head(), *next, *prev = nullptr;
-        PMEMoid free_objs;
         while (cur != nullptr)
         {
             next = cur->next;
 
             assert(cur->epoche < oldestEpoche);
             for (std::size_t i = 0; i < cur->nodesCount; ++i)
-            {
-                //operator delete(cur->nodes[i]);
-                free_objs = pmemobj_oid(cur->nodes[i]);
-                pmemobj_free(&free_objs);
-            }
+                reclaim(cur->nodes[i]);
             d.remove(cur, prev);
             cur = next;
         }
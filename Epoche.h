@@ -43,6 +43,14 @@ namespace thu_ltl
     class Epoche;
     class EpocheGuard;
 
+    //owner of records that live inside larger pool objects, such as log segments
+    class RecordReclaimer
+    {
+    public:
+        virtual void release(void *record) = 0;
+        virtual ~RecordReclaimer() { }
+    };
+
     class ThreadInfo
     {
         friend class Epoche;
@@ -72,11 +80,17 @@ namespace thu_ltl
 
         tbb::enumerable_thread_specific<DeletionList> deletionLists;
 
+        //records are at least 8-byte aligned, so the low bit tells them apart from nodes
+        static constexpr uintptr_t recordTag = 1;
+        void reclaim(void *n);
 
 
 
     public:
         size_t startGCThreshhold;
+        RecordReclaimer *reclaimer = nullptr;
+        //nodes freed so far; a node pointer kept across epochs is valid while this is unchanged
+        std::atomic<uint64_t> freedNodes{0};
         Epoche(size_t startGCThreshhold) : startGCThreshhold(startGCThreshhold) { }
 
         ~Epoche();
@@ -85,6 +99,8 @@ namespace thu_ltl
 
         void markNodeForDeletion(void *n, ThreadInfo &epocheInfo);
 
+        void markRecordForDeletion(void *record, ThreadInfo &epocheInfo);
+
         void exitEpocheAndCleanup(ThreadInfo &info);
 
         void showDeleteRatio();
@@ -12,6 +12,8 @@
 #include <emmintrin.h>
 #include <immintrin.h>
 #include <libpmemobj.h>
+#include "tbb/parallel_for.h"
+#include "tbb/task_arena.h"
 #include "SSBTree.h"
 #include "Epoche.cpp"
 namespace thu_ltl
@@ -21,7 +23,7 @@ namespace thu_ltl
     // version(16bit) number(16bit)
     // Lazyboxflag(2bit) bottomflag(1bit) Obsolete(1bit)
     // Right(2bit) mutex(2bit)
-    // reserve(24bit)
+    // compactflag(1bit) extraboxes(2bit) updates(21bit)
     /********************/
 #define VERSION_BITS (0xFFFFULL << 48)
 #define NUM_BITS (0xFFFFULL << 32)
@@ -30,16 +32,32 @@ namespace thu_ltl
 #define DEL_BITS (1ULL<<28)
 #define RIGHT_BITS (3ULL<<26)
 #define LOCK_BITS (3ULL<<24)
+#define COMPACT_BITS (1ULL<<23)
+#define EXTRA_BITS (3ULL<<21)
+#define UPDATE_BITS (0x1FFFFFULL)
 #define isObsolete(x) ((x&DEL_BITS)!=0)
 #define isBottom(x) ((x&BOTTOM_BITS)!=0)
 #define rightTurn(x) ((x>>26)&1)
 #define versionTurn(x) ((x>>48)&1)
+#define isCompact(x) ((x&COMPACT_BITS)!=0)
+#define slotTurn(x) ((x>>49)&1)
+#define getExtra(x) ((x>>21)&3)
 #define addbox_BITS (1ULL << 30)
 #define delbox_BITS (1ULL << 31)
 #define addVersion_BITS (1ULL << 48)
 #define addNum_BITS (1ULL << 32)
 #define addRight_BITS (1ULL << 26)
+#define addExtra_BITS (1ULL << 21)
 #define getNum(x) ((x >> 32)&0xFFFF)
+//entries counted against Lnum/Rnum, in units of a double-buffered node
+#if defined(NARROW_INNER) || defined(ORDER_STATS)
+#define getLoad(x) (isCompact(x) ? getNum(x) * maxPairsLength / compactPairsLength : \
+                    !isBottom(x) ? getNum(x) * maxPairsLength / innerPairsLength : getNum(x))
+#define pairsLength(x) (isBottom(x) ? maxPairsLength : innerPairsLength)
+#else
+#define getLoad(x) (isCompact(x) ? getNum(x) * maxPairsLength / compactPairsLength : getNum(x))
+#define pairsLength(x) maxPairsLength
+#endif
 
     static constexpr int shifversion = 48;
     static constexpr int shifnumber = 32;
@@ -56,6 +74,12 @@ namespace thu_ltl
         } cacheline_t;
         asm volatile("prefetcht0 %0" : : "m" (*(const cacheline_t *)ptr));
     }
+    //the header and the first pairs of a node, one XPLine
+    static inline void prefetch_node(const Node *node)
+    {
+        for (unsigned long i = 0; i < 256; i += cache_line_size)
+            prefetch_((const char *)node + i);
+    }
     inline void Node::addRight(uint64_t &header)
     {
         uint64_t right = header & RIGHT_BITS;
@@ -86,6 +110,166 @@ namespace thu_ltl
             pmemobj_drain(pop);
 
     }
+    inline PairPtr Node::half(int turn)
+    {
+#ifdef NARROW_INNER
+        if (!isBottom(header))
+            return PairPtr{inner[turn].keys, nullptr, inner[turn].children};
+        return PairPtr{halves[turn].keys, halves[turn].values, nullptr};
+#else
+#ifdef ORDER_STATS
+        if (!isBottom(header))
+#ifdef SOA_LAYOUT
+            return PairPtr{inner[turn].keys, inner[turn].values};
+#else
+            return inner[turn].pairs;
+#endif
+#endif
+#ifdef SOA_LAYOUT
+        return PairPtr{halves[turn].keys, halves[turn].values};
+#else
+        return &pairs[turn * maxPairsLength];
+#endif
+#endif
+    }
+
+    static inline void copy_pairs(PairPtr dst, PairPtr src, int n)
+    {
+#ifdef NARROW_INNER
+        memcpy(dst.keys, src.keys, n * sizeof(Key));
+        if (dst.children)
+            memcpy(dst.children, src.children, n * sizeof(uint32_t));
+        else
+            memcpy(dst.values, src.values, n * sizeof(Oidoff));
+#elif defined(SOA_LAYOUT)
+        memcpy(dst.keys, src.keys, n * sizeof(Key));
+        memcpy(dst.values, src.values, n * sizeof(Oidoff));
+#else
+        memcpy(dst, src, n * sizeof(Pair));
+#endif
+    }
+
+    static inline void clflush_pairs(PMEMobjpool *pop, PairPtr p, int n)
+    {
+#ifdef NARROW_INNER
+        Node::clflush(pop, (char *)p.keys, n * sizeof(Key), false, false);
+        if (p.children)
+            Node::clflush(pop, (char *)p.children, n * sizeof(uint32_t), false, false);
+        else
+            Node::clflush(pop, (char *)p.values, n * sizeof(Oidoff), false, false);
+#elif defined(SOA_LAYOUT)
+        Node::clflush(pop, (char *)p.keys, n * sizeof(Key), false, false);
+        Node::clflush(pop, (char *)p.values, n * sizeof(Oidoff), false, false);
+#else
+        Node::clflush(pop, (char *)p, n * sizeof(Pair), false, false);
+#endif
+    }
+
+#ifdef FINGERPRINT
+    static inline uint8_t fingerprint(Key key)
+    {
+        return KeyTraits::hash(key) >> 56;
+    }
+
+    //rehash slots from~to of a half of a bottom node; flushed together with the pairs
+    static inline void set_fingerprints(PMEMobjpool *pop, Node *node, uint64_t header, int turn, int from, int to)
+    {
+        if (!isBottom(header) || from > to) return;
+        uint8_t *fp = node->fingerprints[turn];
+        PairPtr p = node->half(turn);
+        for (int i = from; i <= to; i++)
+            fp[i] = fingerprint(p[i].key);
+        Node::clflush(pop, (char *)&fp[from], to - from + 1, false, false);
+    }
+#else
+    static inline void set_fingerprints(PMEMobjpool *, Node *, uint64_t, int, int, int) {}
+#endif
+
+#if LAZYBOX_SLOTS > 1
+    //Extra boxes hold more pending inserts of a bottom node whose LazyBox holds an insert.
+    //They have no position in the half and are found by key.
+    static inline int extra_search(Node *node, uint64_t header, const Key &key)
+    {
+        for (int i = 0; i < (int)getExtra(header); i++)
+            if (node->extraBox[i].key == key)
+                return i;
+        return -1;
+    }
+
+    static inline Oidoff *extra_value(Node *node, int i)
+    {
+        return &node->extraBox[i].value;
+    }
+
+    //the LazyBox and the extra boxes, sorted by key
+    static inline int collect_boxes(Node *node, uint64_t header, Pair *boxes)
+    {
+        int n = 1;
+        boxes[0] = node->LazyBox;
+        for (int i = 0; i < (int)getExtra(header); i++)
+        {
+            int j = n++;
+            for (; j > 0 && boxes[j - 1].key > node->extraBox[i].key; j--)
+                boxes[j] = boxes[j - 1];
+            boxes[j] = node->extraBox[i];
+        }
+        return n;
+    }
+#else
+    static inline int extra_search(Node *, uint64_t, const Key &) { return -1; }
+    static inline Oidoff *extra_value(Node *, int) { return nullptr; }
+    static inline int collect_boxes(Node *node, uint64_t, Pair *boxes)
+    {
+        boxes[0] = node->LazyBox;
+        return 1;
+    }
+#endif
+
+    //the pairs of a bottom node in key order, with its LazyBox and extra boxes applied
+    static inline int node_pairs(Node *node, uint64_t header, Pair *pairs)
+    {
+        int lazyflag = (header >> shiflazybox) & 3;
+        int end = getNum(header) - 1 - lazydiff[lazyflag] - getExtra(header);
+        PairPtr offset_pair = node->half(versionTurn(header));
+        Pair boxes[lazySlots];
+        int nbox = lazyflag == 1 ? collect_boxes(node, header, boxes) : 0;
+        int n = 0;
+        for (int i = 0, b = 0; i <= end || b < nbox;)
+        {
+            if (b == nbox || (i <= end && offset_pair[i].key < boxes[b].key))
+            {
+                //a pending delete is still in the array
+                if (lazyflag == 2 && offset_pair[i].key == node->LazyBox.key)
+                    i++;
+                else
+                    pairs[n++] = offset_pair[i++];
+            }
+            else
+                pairs[n++] = boxes[b++];
+        }
+        return n;
+    }
+
+    //switch a bottom node to the n pairs written to its other half, dropping all boxes
+    static inline void switch_half(PMEMobjpool *pop, Node *node, uint64_t header, int n)
+    {
+        PairPtr move_pair = node->half(versionTurn(header) ^ 1);
+        clflush_pairs(pop, move_pair, n);
+        set_fingerprints(pop, node, header, versionTurn(header) ^ 1, 0, n - 1);
+        if (n - 1 >= (int)midindex)
+            node->midkey[versionTurn(header) ^ 1] = move_pair[midindex].key;
+        node->header = ((header & ~(BOX_BITS | EXTRA_BITS | NUM_BITS)) | (uint64_t)n << shifnumber) + addVersion_BITS;
+        Node::clflush(pop, (char *) &node->header, sizeof(uint64_t), true, true);
+    }
+
+    //an in-place value update keeps the version; it is counted in the header for snapshotScan.
+    //The caller holds the node lock
+    static inline void count_update(Node *node)
+    {
+        uint64_t header = node->header;
+        node->header = (header & ~UPDATE_BITS) | ((header + 1) & UPDATE_BITS);
+    }
+
     //Optimized Optimistic Concurrency Control
     inline bool Node::ReadcheckVesion(uint64_t ol, uint64_t ne)
     {
@@ -111,7 +295,27 @@ namespace thu_ltl
     void SSBTree::reStart(PMEMobjpool *setpop)
     {
         pop = setpop;
+#ifdef STRING_KEY
+        //the tree is the root object of its pool
+        StringKey::poolBase = (char *)this - pmemobj_oid(this).off;
+#endif
         epoche = new Epoche(256);
+        //the tree is the root object of its pool
+        valueLog = new ValueLog(pop, (char *)this - pmemobj_oid(this).off);
+        epoche->reclaimer = valueLog;
+        rightmostLeaf = 0;
+        //the spare node of the previous run was never linked into the tree
+        if (spareOid.off)
+            pmemobj_free(&spareOid);
+        spareNode = 0;
+#ifdef ORDER_STATS
+        countRun++;
+        Node::clflush(pop, (char *)&countRun, sizeof(countRun), false, true);
+        countClock = 1;
+#endif
+#ifdef FINGER_CACHE
+        fingers = new tbb::enumerable_thread_specific<Finger>();
+#endif
         pobj_alloc_class_desc AllocClass;
         AllocClass.unit_size = NodeSize;
         AllocClass.alignment = 256; // physical granularity of DCPMM
@@ -127,27 +331,46 @@ namespace thu_ltl
         }
     }
 
-    void SSBTree::pmdk_constructor(uint32_t lnum, uint32_t rnum)
+    //a new node has no counts yet; the memory may hold a valid stamp of a freed node
+#ifdef ORDER_STATS
+    static inline void clear_counts(Node *node)
+    {
+        node->countStamp = 0;
+    }
+#else
+    static inline void clear_counts(Node *) {}
+#endif
+
+    //compactLeaf selects the bottom node format of a new tree; splits keep it
+    void SSBTree::pmdk_constructor(uint32_t lnum, uint32_t rnum, bool compactLeaf)
     {
         Lnum = lnum;
         Rnum = rnum;
         epoche = new Epoche(256);
+        epoche->reclaimer = valueLog;
         uint64_t header = BOTTOM_BITS + addNum_BITS;
-        pmemobj_xalloc(pop, &tailoid.oid, sizeof(Node), 0, POBJ_CLASS_ID(128), NULL, NULL);
-        Node *tail = D_RW(tailoid);
-        tail->header = (header);
-        tail->pairs[0].key = -1;
-        tail->pairs[0].value = 0;
-        Node::clflush(pop, (char *) tail, sizeof(Node), false, true);
+        if (compactLeaf)
+            header |= COMPACT_BITS;
+        newTail(header);
 
 
         pmemobj_xalloc(pop, &headoid.oid, sizeof(Node), 0, POBJ_CLASS_ID(128), NULL, NULL);
         Node *head = D_RW(headoid);
         head->header = (header);
         head->right[0] = tailoid.oid.off;
-        head->maxKey[0] = -1;
-        head->pairs[0].key = 0;
-        head->pairs[0].value = 0;
+        head->maxKey[0] = KeyTraits::maxKey;
+        if (compactLeaf)
+        {
+            head->compact.pairs[0].key = KeyTraits::minKey;
+            head->compact.pairs[0].value = 0;
+            head->compact.slots[0][0] = 0;
+        }
+        else
+        {
+            head->half(0)[0].key = KeyTraits::minKey;
+            head->half(0)[0].value = 0;
+            set_fingerprints(pop, head, header, 0, 0, 0);
+        }
         Node::clflush(pop, (char *) head, sizeof(Node), false, true);
 
         header = addNum_BITS;
@@ -155,16 +378,225 @@ namespace thu_ltl
         TOID(Node) typeNode;
         pmemobj_xalloc(pop, &typeNode.oid, sizeof(Node), 0, POBJ_CLASS_ID(128), NULL, NULL);
         Node *newhead = D_RW(typeNode);
+        clear_counts(newhead);
         newhead->header = (header);
         newhead->right[0] = tailoid.oid.off;
-        newhead->maxKey[0] = -1;
-        newhead->pairs[0].key = 0;
-        newhead->pairs[0].value = headoid.oid.off;
+        newhead->maxKey[0] = KeyTraits::maxKey;
+        newhead->half(0)[0].key = KeyTraits::minKey;
+        newhead->half(0)[0].value = headoid.oid.off;
         Node::clflush(pop, (char *)newhead, sizeof(Node), false, true);
         rootoid = headoid;
         headoid = typeNode;
         Node::clflush(pop, (char *)this, sizeof(SSBTree), false, true);
     }
+    //the tail node ends every level; its only key is the reserved maxKey
+    void SSBTree::newTail(uint64_t header)
+    {
+        pmemobj_xalloc(pop, &tailoid.oid, sizeof(Node), 0, POBJ_CLASS_ID(128), NULL, NULL);
+        Node *tail = D_RW(tailoid);
+        tail->header = (header);
+        if (isCompact(header))
+        {
+            tail->compact.pairs[0].key = KeyTraits::maxKey;
+            tail->compact.pairs[0].value = 0;
+            tail->compact.slots[0][0] = 0;
+        }
+        else
+        {
+            tail->half(0)[0].key = KeyTraits::maxKey;
+            tail->half(0)[0].value = 0;
+            set_fingerprints(pop, tail, header, 0, 0, 0);
+        }
+        Node::clflush(pop, (char *) tail, sizeof(Node), false, true);
+    }
+
+    //a node of a bulk load, written in place and flushed once by bulkClose
+    Node *SSBTree::bulkNode(uint64_t &off, uint64_t header)
+    {
+        TOID(Node) nodeoid;
+        pmemobj_xalloc(pop, &nodeoid.oid, sizeof(Node), 0, POBJ_CLASS_ID(128), NULL, NULL);
+        Node *node = D_RW(nodeoid);
+        pmemobj_mutex_zero(pop, &node->mutex);
+        clear_counts(node);
+        node->header = header; //selects the layout of node->half()
+        node->lazyPosition = 0;
+        off = nodeoid.oid.off;
+        return node;
+    }
+
+    //a new top level starts with the minKey separator to the head of the level below
+    void SSBTree::bulkLevel(std::vector<BulkLevel> &levels)
+    {
+        BulkLevel top;
+        top.node = bulkNode(top.off, 0);
+        top.head = top.off;
+        top.node->half(0)[0] = Pair{KeyTraits::minKey, levels.back().head};
+        top.num = 1;
+        levels.push_back(top);
+    }
+
+    static inline void bulk_put(BulkLevel &level, const Pair &pair)
+    {
+        if (isCompact(level.node->header))
+        {
+            level.node->compact.pairs[level.num] = pair;
+            level.node->compact.slots[0][level.num] = level.num;
+        }
+        else
+            level.node->half(0)[level.num] = pair;
+        level.num++;
+    }
+
+    void SSBTree::bulkClose(BulkLevel &level, Oidoff right, const Key &maxKey)
+    {
+        Node *node = level.node;
+        uint64_t header = node->header | (uint64_t)level.num << shifnumber;
+        node->header = header;
+        node->right[0] = right;
+        node->maxKey[0] = maxKey;
+        if (!isCompact(header))
+        {
+            if (level.num - 1 >= midindex)
+                node->midkey[0] = node->half(0)[midindex].key;
+            set_fingerprints(pop, node, header, 0, 0, level.num - 1);
+        }
+        //no fence: the nodes are unreachable until the tree itself is flushed
+        Node::clflush(pop, (char *)node, sizeof(Node), false, false);
+    }
+
+    //a full node of a level is closed, linked to a new one, and the new one is added to the level above
+    void SSBTree::bulkAppend(std::vector<BulkLevel> &levels, size_t level, const Pair &pair)
+    {
+        if (level == levels.size())
+            bulkLevel(levels);
+        BulkLevel *b = &levels[level];
+        uint64_t header = b->node->header;
+        int capacity = (isCompact(header) ? compactPairsLength : pairsLength(header)) - 1;
+        if (b->num == capacity)
+        {
+            uint64_t off;
+            Node *node = bulkNode(off, header);
+            bulkClose(*b, off, pair.key);
+            b->node = node;
+            b->off = off;
+            b->num = 0;
+            bulkAppend(levels, level + 1, Pair{pair.key, off});
+            b = &levels[level];
+        }
+        bulk_put(*b, pair);
+    }
+
+    //Every node is written once, in key order, one pair short of full: the most it holds between two puts.
+    void SSBTree::bulk_constructor(uint32_t lnum, uint32_t rnum, const std::function<bool(Pair &)> &next, bool compactLeaf)
+    {
+        Lnum = lnum;
+        Rnum = rnum;
+        epoche = new Epoche(256);
+        epoche->reclaimer = valueLog;
+        uint64_t header = BOTTOM_BITS;
+        if (compactLeaf)
+            header |= COMPACT_BITS;
+        newTail(header + addNum_BITS);
+
+        std::vector<BulkLevel> levels(1);
+        levels[0].node = bulkNode(levels[0].off, header);
+        levels[0].head = levels[0].off;
+        levels[0].num = 0;
+        bulkAppend(levels, 0, Pair{KeyTraits::minKey, 0});
+        Pair pair;
+        while (next(pair))
+        {
+#ifdef STRING_KEY
+            if (pair.key.isTransient())
+                pair.key = storeKey(pair.key);
+#endif
+            bulkAppend(levels, 0, pair);
+        }
+        //searches start at the head of the level below the top, so that level is a single node
+        while (levels.size() == 1 || levels.back().num > 1)
+            bulkLevel(levels);
+        for (BulkLevel &level : levels)
+            bulkClose(level, tailoid.oid.off, KeyTraits::maxKey);
+
+        headoid = rootoid = tailoid;
+        headoid.oid.off = levels.back().head;
+        rootoid.oid.off = levels[levels.size() - 2].head;
+        Node::clflush(pop, (char *)this, sizeof(SSBTree), true, true);
+    }
+
+    //One level of a parallel bulk load, cut into nodes at fixed positions of its n entries.
+    //Returns the first key and the offset of each node, the entries of the level above.
+    std::vector<Pair> SSBTree::bulkBuild(uint64_t header, uint64_t n, const std::function<Pair(uint64_t)> &entry)
+    {
+        uint64_t capacity = (isCompact(header) ? compactPairsLength : pairsLength(header)) - 1;
+        uint64_t count = (n + capacity - 1) / capacity;
+        std::vector<Pair> nodes(count);
+        std::vector<Node *> direct(count);
+        //node j links to node j + 1, so all nodes of the level are allocated first
+        tbb::parallel_for((uint64_t)0, count, [&](uint64_t j)
+        {
+            uint64_t off;
+            direct[j] = bulkNode(off, header);
+            nodes[j] = Pair{entry(j * capacity).key, off};
+#ifdef STRING_KEY
+            if (nodes[j].key.isTransient())
+                nodes[j].key = storeKey(nodes[j].key);
+#endif
+        });
+        tbb::parallel_for((uint64_t)0, count, [&](uint64_t j)
+        {
+            BulkLevel level{direct[j], nodes[j].value, nodes[j].value, 0};
+            bulk_put(level, Pair{nodes[j].key, entry(j * capacity).value});
+            for (uint64_t i = j * capacity + 1; i < std::min(n, (j + 1) * capacity); i++)
+            {
+                Pair pair = entry(i);
+#ifdef STRING_KEY
+                if (pair.key.isTransient())
+                    pair.key = storeKey(pair.key);
+#endif
+                bulk_put(level, pair);
+            }
+            if (j + 1 < count)
+                bulkClose(level, nodes[j + 1].value, nodes[j + 1].key);
+            else
+                bulkClose(level, tailoid.oid.off, KeyTraits::maxKey);
+        });
+        return nodes;
+    }
+
+    //Builds the same tree as the sequential bulk_constructor, level by level, with the nodes of a level written by TBB tasks.
+    void SSBTree::bulk_constructor(uint32_t lnum, uint32_t rnum, const Pair *pairs, uint64_t n, bool compactLeaf)
+    {
+        Lnum = lnum;
+        Rnum = rnum;
+        epoche = new Epoche(256);
+        epoche->reclaimer = valueLog;
+        uint64_t header = BOTTOM_BITS;
+        if (compactLeaf)
+            header |= COMPACT_BITS;
+        newTail(header + addNum_BITS);
+
+        std::vector<Pair> level = bulkBuild(header, n + 1, [&](uint64_t i)
+        {
+            return i ? pairs[i - 1] : Pair{KeyTraits::minKey, 0};
+        });
+        std::vector<Pair> below;
+        //up to a top node with the single separator to the head of the level below, as in the sequential build
+        while (level.size() > 1 || below.empty() || below.size() > 1)
+        {
+            below = std::move(level);
+            level = bulkBuild(0, below.size(), [&](uint64_t i)
+            {
+                return below[i];
+            });
+        }
+
+        headoid = rootoid = tailoid;
+        headoid.oid.off = level[0].value;
+        rootoid.oid.off = below[0].value;
+        Node::clflush(pop, (char *)this, sizeof(SSBTree), true, true);
+    }
+
     SSBTree::SSBTree(uint32_t lnum = maxPairsLength, uint32_t rnum = maxPairsLength * 8): Lnum(lnum), Rnum(rnum)
     {
     }
@@ -174,23 +606,30 @@ namespace thu_ltl
     {
     }
 
-    inline int64_t SSBTree::signextend(const uint64_t x)
+#ifdef STRING_KEY
+    //copy the bytes of a transient key into the pool.
+    //Stored keys are never freed: separators and maxKey bounds may still refer to them after a remove.
+    Key SSBTree::storeKey(const Key &key)
     {
-        struct
-        {
-int64_t x:
-            highPosition;
-        } s;
-        return s.x = x;
+        KeyView v = key.view();
+        PMEMoid oid;
+        pmemobj_alloc(pop, &oid, sizeof(uint32_t) + v.len, 0, NULL, NULL);
+        char *stored = (char *)pmemobj_direct(oid);
+        *(uint32_t *)stored = v.len;
+        memcpy(stored + sizeof(uint32_t), v.data, v.len);
+        pmemobj_persist(pop, stored, sizeof(uint32_t) + v.len);
+        return Key(key.prefix, oid.off);
     }
+#endif
 
     void SSBTree::upKey(Node *&node, uint64_t &header, int &lazyflag, Pair &lazybox, Pair &upPair,
-                        Pair *&move_pair, Pair *&offset_pair,
+                        PairPtr &move_pair, PairPtr &offset_pair,
                         int &LessOrEqual, int &endlocation)
 
     {
-        uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-        int w1 = (v ^ signextend(v)) >> highPosition;
+        //an update rewrites the LazyBox value without a new header, so the caller's copy may be stale
+        lazybox.value = node->LazyBox.value;
+        int w1 = node->lazyPosition;
         int w2 = LessOrEqual + 1;
         if (lazyflag == 0x2)
         {
@@ -210,23 +649,36 @@ int64_t x:
             if (w2 > w1 && w2 - 1 > endlocation) //append
             {
                 offset_pair[w2 - 1] = upPair;
-                Node::clflush(pop, (char *)&offset_pair[w2 - 1], sizeof(Pair), false, false);
+                clflush_pairs(pop, offset_pair + (w2 - 1), 1);
+                set_fingerprints(pop, node, header, versionTurn(header), w2 - 1, w2 - 1);
                 if (w2 - 1 == midindex)
                     node->midkey[versionTurn(header)] = upPair.key;
                 node->header = (header + addNum_BITS + 2 * addVersion_BITS);
                 Node::clflush(pop, (char *) &node->header, sizeof(uint64_t), true, true);
             }
+#if LAZYBOX_SLOTS > 1
+            else if (isBottom(header) && getExtra(header) < lazySlots - 1) //one more pending insert
+            {
+                node->extraBox[getExtra(header)] = upPair;
+                Node::clflush(pop, (char *) &node->extraBox[getExtra(header)], sizeof(Pair), false, false);
+                node->header = (header + addExtra_BITS + addNum_BITS);
+                Node::clflush(pop, (char *) &node->header, sizeof(uint64_t), true, true);
+            }
+            else if (getExtra(header))
+                boxMerge(node, header, &upPair, nullptr);
+#endif
             else
             {
 
                 move_pair[w1].key = lazybox.key;
-                move_pair[w1].value = signextend(lazybox.value);
+                move_pair[w1].value = lazybox.value;
                 move_pair[w2] = upPair;
                 if (w1 > w2 ) std::swap(w1, w2);
-                memcpy(move_pair, offset_pair, w1 * sizeof(Pair)); //0~w1-1
-                memcpy(move_pair + w1 + 1, offset_pair + w1, (w2 - w1 - 1)*sizeof(Pair)); //w1+1~w2-1
-                memcpy(move_pair + w2 + 1, offset_pair + w2 - 1, (endlocation - w2 + 2)*sizeof(Pair)); //w2+1~end
-                Node::clflush(pop, (char *)move_pair, (endlocation + 3) * sizeof(Pair), false, false);
+                copy_pairs(move_pair, offset_pair, w1); //0~w1-1
+                copy_pairs(move_pair + w1 + 1, offset_pair + w1, w2 - w1 - 1); //w1+1~w2-1
+                copy_pairs(move_pair + w2 + 1, offset_pair + w2 - 1, endlocation - w2 + 2); //w2+1~end
+                clflush_pairs(pop, move_pair, endlocation + 3);
+                set_fingerprints(pop, node, header, versionTurn(header) ^ 1, 0, endlocation + 2);
                 if (endlocation + 2 >= midindex)
                     node->midkey[versionTurn(header) ^ 1] = move_pair[midindex].key;
                 node->header = ((header ^ addbox_BITS) + addVersion_BITS + addNum_BITS);
@@ -239,17 +691,18 @@ int64_t x:
             move_pair[w2] = upPair;
             if (w1 <= w2)
             {
-                memcpy(move_pair, offset_pair, w1 * sizeof(Pair)); //0~w1-1
-                memcpy(move_pair + w1, offset_pair + w1 + 1, (w2 - w1)*sizeof(Pair)); //w1-1~w2-1
-                memcpy(move_pair + w2 + 1, offset_pair + w2 + 1, (endlocation - w2)*sizeof(Pair)); //w2+1~end(ebd=oldend-1)
+                copy_pairs(move_pair, offset_pair, w1); //0~w1-1
+                copy_pairs(move_pair + w1, offset_pair + w1 + 1, w2 - w1); //w1-1~w2-1
+                copy_pairs(move_pair + w2 + 1, offset_pair + w2 + 1, endlocation - w2); //w2+1~end(ebd=oldend-1)
             }
             else
             {
-                memcpy(move_pair, offset_pair, w2 * sizeof(Pair)); //0~w2-1
-                memcpy(move_pair + w2 + 1, offset_pair + w2, (w1 - w2)*sizeof(Pair)); //w2~w1-1
-                memcpy(move_pair + w1 + 1, offset_pair + w1 + 1, (endlocation - w1)*sizeof(Pair)); //w1+1~end
+                copy_pairs(move_pair, offset_pair, w2); //0~w2-1
+                copy_pairs(move_pair + w2 + 1, offset_pair + w2, w1 - w2); //w2~w1-1
+                copy_pairs(move_pair + w1 + 1, offset_pair + w1 + 1, endlocation - w1); //w1+1~end
             }
-            Node::clflush(pop, (char *)move_pair, (endlocation + 1) * sizeof(Pair), false, false);
+            clflush_pairs(pop, move_pair, endlocation + 1);
+            set_fingerprints(pop, node, header, versionTurn(header) ^ 1, 0, endlocation);
             if (endlocation >= midindex)
                 node->midkey[versionTurn(header) ^ 1] = move_pair[midindex].key;
             node->header = ((header ^ delbox_BITS) + addVersion_BITS + addNum_BITS);
@@ -261,7 +714,8 @@ int64_t x:
             if (w2 > endlocation) //append
             {
                 offset_pair[w2] = upPair;
-                Node::clflush(pop, (char *)&offset_pair[w2], sizeof(Pair), false, false);
+                clflush_pairs(pop, offset_pair + w2, 1);
+                set_fingerprints(pop, node, header, versionTurn(header), w2, w2);
                 if (w2 == midindex)
                     node->midkey[versionTurn(header)] = upPair.key;
                 node->header = (header + addNum_BITS + 2 * addVersion_BITS);
@@ -270,14 +724,15 @@ int64_t x:
             else
             {
                 node->LazyBox.key = upPair.key;
-                node->LazyBox.value = upPair.value ^ ((uint64_t)w2 << highPosition);
+                node->LazyBox.value = upPair.value;
+                node->lazyPosition = w2;
                 node->header = ((header | addbox_BITS) + addNum_BITS);
                 Node::clflush(pop, (char *) &node->header, cache_line_size, false, true);
 
             }
         }
 
-        split(node);
+        split(node, upPair.key);
         if (node == D_RW(headoid))
         {
             TOID(Node) typeNode;
@@ -286,24 +741,34 @@ int64_t x:
 
 
             pmemobj_mutex_zero(pop, &newhead->mutex);
+            clear_counts(newhead);
             newhead->header = (addNum_BITS);
             newhead->right[0] = tailoid.oid.off;
-            newhead->maxKey[0] = -1;
-            newhead->pairs[0].key = 0;
-            newhead->pairs[0].value = headoid.oid.off;
-            Node::clflush(pop, (char *)newhead, cache_line_size + 2 * sizeof(Pair), false, true);
+            newhead->maxKey[0] = KeyTraits::maxKey;
+            newhead->half(0)[0].key = KeyTraits::minKey;
+            newhead->half(0)[0].value = headoid.oid.off;
+            clflush_pairs(pop, newhead->half(0), 1);
+            Node::clflush(pop, (char *)newhead, cache_line_size, false, true);
             rootoid = headoid;
             headoid = typeNode;
             Node::clflush(pop, (char *)this, sizeof(SSBTree), false, true);
         }
     }
     void SSBTree::downKey(Node *&node, uint64_t &header, int &lazyflag, Pair &lazybox, Pair &downPair,
-                          Pair *&move_pair, Pair *&offset_pair,
+                          PairPtr &move_pair, PairPtr &offset_pair,
                           int &LessOrEqual, int &endlocation, ThreadInfo &threadEpocheInfo)
     {
-        uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-        int w1 = (v ^ signextend(v)) >> highPosition;
+        if (getExtra(header))
+        {
+            downPair.value = boxMerge(node, header, nullptr, &downPair.key);
+            return;
+        }
+        lazybox.value = node->LazyBox.value;
+        int w1 = node->lazyPosition;
         int w2 = LessOrEqual;
+        //hand the removed value back to the caller
+        if (isBottom(header))
+            downPair.value = lazyflag == 1 && downPair.key == lazybox.key ? node->LazyBox.value : offset_pair[w2].value;
         if (lazyflag == 1)
         {
             if (w2 < w1) w1--;
@@ -311,7 +776,10 @@ int64_t x:
         if (lazyflag == 2) //two de -> COW
         {
             if (downPair.key == lazybox.key)
+            {
+                downPair.value = 0;
                 return;
+            }
             //if (w2==endlocation)
             //{
             //    node->header =(header-addNum_BITS);
@@ -319,10 +787,11 @@ int64_t x:
             //} else
             {
                 if (w1 > w2 ) std::swap(w1, w2);
-                memcpy(move_pair, offset_pair, w1 * sizeof(Pair)); //0~w1-1
-                memcpy(move_pair + w1 , offset_pair + w1 + 1, (w2 - w1 - 1)*sizeof(Pair)); //w1+1~w2-1
-                memcpy(move_pair + w2 - 1, offset_pair + w2 + 1, (endlocation - w2)*sizeof(Pair)); //w2+1~end
-                Node::clflush(pop, (char *)move_pair, (endlocation - 1)*sizeof(Pair), false, false);
+                copy_pairs(move_pair, offset_pair, w1); //0~w1-1
+                copy_pairs(move_pair + w1 , offset_pair + w1 + 1, w2 - w1 - 1); //w1+1~w2-1
+                copy_pairs(move_pair + w2 - 1, offset_pair + w2 + 1, endlocation - w2); //w2+1~end
+                clflush_pairs(pop, move_pair, endlocation - 1);
+                set_fingerprints(pop, node, header, versionTurn(header) ^ 1, 0, endlocation - 2);
 
                 if (endlocation - 2 >= midindex)
                     node->midkey[versionTurn(header) ^ 1] = move_pair[midindex].key;
@@ -338,7 +807,7 @@ int64_t x:
                 node->header = ((header ^ addbox_BITS) + addVersion_BITS + addVersion_BITS - addNum_BITS);
                 Node *head = D_RW(headoid);
                 TOID(Node) nheadoid = headoid;
-                nheadoid.oid.off = head->pairs[0].value ;
+                nheadoid.oid.off = head->half(0)[0].value ;
                 if (node == D_RW(nheadoid) && getNum(node->header) == 1 && !isBottom(node->header))
                 {
 
@@ -346,27 +815,28 @@ int64_t x:
                     head->header = (head->header | DEL_BITS);
                     Node::clflush(pop, (char *)&head->header, sizeof(uint64_t), false, true);
                     headoid = nheadoid;
-                    rootoid.oid.off = D_RW(headoid)->pairs[0].value;
+                    rootoid.oid.off = D_RW(headoid)->half(0)[0].value;
                     Node::clflush(pop, (char *)this, sizeof(SSBTree), false, true);
                 }
                 return;
             }
             std::swap(w1, w2);
             move_pair[w2].key = lazybox.key;
-            move_pair[w2].value = signextend(reinterpret_cast<uint64_t>(lazybox.value));
+            move_pair[w2].value = lazybox.value;
             if (w1 <= w2)
             {
-                memcpy(move_pair, offset_pair, w1 * sizeof(Pair)); //0~w1-1
-                memcpy(move_pair + w1, offset_pair + w1 + 1, (w2 - w1)*sizeof(Pair)); //w1-1~w2-1
-                memcpy(move_pair + w2 + 1, offset_pair + w2 + 1, (endlocation - w2)*sizeof(Pair)); //w2+1~end(ebd=oldend-1)
+                copy_pairs(move_pair, offset_pair, w1); //0~w1-1
+                copy_pairs(move_pair + w1, offset_pair + w1 + 1, w2 - w1); //w1-1~w2-1
+                copy_pairs(move_pair + w2 + 1, offset_pair + w2 + 1, endlocation - w2); //w2+1~end(ebd=oldend-1)
             }
             else
             {
-                memcpy(move_pair, offset_pair, w2 * sizeof(Pair)); //0~w2-1
-                memcpy(move_pair + w2 + 1, offset_pair + w2, (w1 - w2)*sizeof(Pair)); //w2~w1-1
-                memcpy(move_pair + w1 + 1, offset_pair + w1 + 1, (endlocation - w1)*sizeof(Pair)); //w1+1~end
+                copy_pairs(move_pair, offset_pair, w2); //0~w2-1
+                copy_pairs(move_pair + w2 + 1, offset_pair + w2, w1 - w2); //w2~w1-1
+                copy_pairs(move_pair + w1 + 1, offset_pair + w1 + 1, endlocation - w1); //w1+1~end
             }
-            Node::clflush(pop, (char *)move_pair, (endlocation + 1) * sizeof(Pair), false, false);
+            clflush_pairs(pop, move_pair, endlocation + 1);
+            set_fingerprints(pop, node, header, versionTurn(header) ^ 1, 0, endlocation);
             if (endlocation >= midindex)
                 node->midkey[versionTurn(header) ^ 1] = move_pair[midindex].key;
             node->header = ((header ^ addbox_BITS) + addVersion_BITS - addNum_BITS);
@@ -384,7 +854,8 @@ int64_t x:
             //} else
             {
                 node->LazyBox.key = downPair.key;
-                node->LazyBox.value = ((uint64_t)w2 << highPosition);
+                node->LazyBox.value = 0;
+                node->lazyPosition = w2;
                 node->header = ((header | delbox_BITS) - addNum_BITS)  ;
                 Node::clflush(pop, (char *) &node->header, cache_line_size, false, true);
 
@@ -392,14 +863,14 @@ int64_t x:
         }
         Node *head = D_RW(headoid);
         TOID(Node) nheadoid = headoid;
-        nheadoid.oid.off = head->pairs[0].value;
+        nheadoid.oid.off = head->half(0)[0].value;
         if (node == D_RW(nheadoid) && getNum(node->header) == 1 && !isBottom(node->header))
         {
             epoche->markNodeForDeletion((void *)head, threadEpocheInfo);
             head->header = (head->header | DEL_BITS);
             Node::clflush(pop, (char *)&head->header, sizeof(uint64_t), false, true);
             headoid = nheadoid;
-            rootoid.oid.off = D_RW(headoid)->pairs[0].value;
+            rootoid.oid.off = D_RW(headoid)->half(0)[0].value;
             Node::clflush(pop, (char *)this, sizeof(SSBTree), false, true);
         }
     }
@@ -408,14 +879,85 @@ int64_t x:
 
 
     //return upper-bound's location
-    void SSBTree::linear_search(int &k, Pair *offset_pair, const int &n, const uint64_t &findkey)
+    //One cache line is compared per step. With interleaved pairs only the
+    //even lanes hold keys; with SOA_LAYOUT every lane is a key.
+    //Keys other than 64 bits use the scalar loop.
+    void SSBTree::linear_search(int &k, PairPtr offset_pair, const int &n, const Key &findkey)
     {
+#if defined(USE_AVX512) && KEY_BITS == 64 && !defined(STRING_KEY)
+        if (k > n) return;
+        const __m512i target = _mm512_set1_epi64(findkey);
+#ifdef SOA_LAYOUT
+        for (; k <= n; k += 8)
+        {
+            prefetch_((const char *)&offset_pair[k + 8].key);
+            int left = n - k + 1;
+            __mmask8 valid = left >= 8 ? 0xFF : (1 << left) - 1;
+            __m512i data = _mm512_maskz_loadu_epi64(valid, &offset_pair[k].key);
+            __mmask8 gt = _mm512_mask_cmpgt_epu64_mask(valid, data, target);
+            if (gt)
+            {
+                k += __builtin_ctz(gt);
+                return;
+            }
+        }
+#else
+        for (; k <= n; k += 4)
+        {
+            prefetch_((const char *)&offset_pair[k + 4].key);
+            int left = n - k + 1;
+            __mmask8 valid = left >= 4 ? 0xFF : (1 << (left << 1)) - 1;
+            __m512i data = _mm512_maskz_loadu_epi64(valid, &offset_pair[k].key);
+            __mmask8 gt = _mm512_mask_cmpgt_epu64_mask(valid & 0x55, data, target);
+            if (gt)
+            {
+                k += __builtin_ctz(gt) >> 1;
+                return;
+            }
+        }
+#endif
+        k = n + 1;
+#elif defined(__AVX2__) && KEY_BITS == 64 && !defined(STRING_KEY)
+        if (k > n) return;
+        //no unsigned 64-bit compare in AVX2: flip the sign bit of both sides
+        const __m256i sign = _mm256_set1_epi64x(0x8000000000000000ULL);
+        const __m256i target = _mm256_xor_si256(_mm256_set1_epi64x(findkey), sign);
+        for (; k <= n; k += 4)
+        {
+            prefetch_((const char *)&offset_pair[k + 4].key);
+            int left = n - k + 1;
+#ifdef SOA_LAYOUT
+            int valid = left >= 4 ? 0xF : (1 << left) - 1;
+            __m256i data = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&offset_pair[k].key), sign);
+            int gt = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(data, target)));
+            gt &= valid;
+            if (gt)
+            {
+                k += __builtin_ctz(gt);
+                return;
+            }
+#else
+            int valid = left >= 4 ? 0xFF : (1 << (left << 1)) - 1;
+            __m256i lo = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&offset_pair[k].key), sign);
+            __m256i hi = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&offset_pair[k + 2].key), sign);
+            int gt = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(lo, target)))
+                     | (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(hi, target))) << 4);
+            gt &= valid & 0x55;
+            if (gt)
+            {
+                k += __builtin_ctz(gt) >> 1;
+                return;
+            }
+#endif
+        }
+        k = n + 1;
+#else
         if (k <= n)
-            prefetch_((const char *)&offset_pair[k]);
+            prefetch_((const char *)&offset_pair[k].key);
         int m = n - 4;
         for (; k <= m ; k++)
         {
-            prefetch_((const char *)&offset_pair[k + 4]);
+            prefetch_((const char *)&offset_pair[k + 4].key);
 
             if (offset_pair[k].key > findkey)
                 return;
@@ -432,38 +974,172 @@ int64_t x:
         for (; k <= n ; k++)
             if (offset_pair[k].key > findkey)
                 break;
-
+#endif
         return;
     }
 
-    void SSBTree::split(Node *node)
+#ifdef FINGERPRINT
+    //return the slot of findkey in offset_pair[0..n], or -1
+    //only slots whose fingerprint matches are compared by key
+    int SSBTree::fingerprint_search(const uint8_t *fingerprints, PairPtr offset_pair, const int &n, const Key &findkey)
+    {
+        //64 fingerprints per step
+        for (int base = 0; base <= n; base += 64)
+        {
+            int last = std::min(n - base, 63);
+#if defined(USE_AVX512)
+            uint64_t valid = (2ULL << last) - 1;
+            __m512i fp = _mm512_maskz_loadu_epi8(valid, fingerprints + base);
+            uint64_t match = _mm512_mask_cmpeq_epi8_mask(valid, fp, _mm512_set1_epi8((char)fingerprint(findkey)));
+#elif defined(__AVX2__)
+            const __m256i target = _mm256_set1_epi8((char)fingerprint(findkey));
+            uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(fingerprints + base)), target));
+            uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(fingerprints + base + 32)), target));
+            uint64_t match = (lo | hi << 32) & ((2ULL << last) - 1);
+#else
+            uint8_t target = fingerprint(findkey);
+            uint64_t match = 0;
+            for (int i = 0; i <= last; i++)
+                if (fingerprints[base + i] == target)
+                    match |= 1ULL << i;
+#endif
+            for (; match; match &= match - 1)
+            {
+                int i = base + __builtin_ctzll(match);
+                if (offset_pair[i].key == findkey)
+                    return i;
+            }
+        }
+        return -1;
+    }
+#endif
+
+    //Copy-on-write of a bottom node with extra boxes: the array and all boxes are merged by key into the other half.
+    //insertPair is added and removeKey left out on the way; returns the value of removeKey.
+    uint64_t SSBTree::boxMerge(Node *node, uint64_t header, const Pair *insertPair, const Key *removeKey)
+    {
+        Pair boxes[lazySlots + 1];
+        int nbox = collect_boxes(node, header, boxes);
+        if (insertPair)
+        {
+            int j = nbox++;
+            for (; j > 0 && boxes[j - 1].key > insertPair->key; j--)
+                boxes[j] = boxes[j - 1];
+            boxes[j] = *insertPair;
+        }
+
+        PairPtr offset_pair = node->half(versionTurn(header));
+        PairPtr move_pair = node->half(versionTurn(header) ^ 1);
+        int end = getNum(header) - 1 - lazydiff[1] - getExtra(header);
+        uint64_t removed = 0;
+        int n = 0;
+        for (int i = 0, b = 0; i <= end || b < nbox;)
+        {
+            Pair pair;
+            if (b == nbox || (i <= end && offset_pair[i].key < boxes[b].key))
+                pair = offset_pair[i++];
+            else
+                pair = boxes[b++];
+            if (removeKey && pair.key == *removeKey)
+            {
+                removed = pair.value;
+                continue;
+            }
+            move_pair[n++] = pair;
+        }
+        switch_half(pop, node, header, n);
+        return removed;
+    }
+
+    //spareNode is 0 when there is no spare node, and spareBusy while a thread allocates or takes it
+    static constexpr uint64_t spareBusy = 1;
+
+    //a split takes the node an appender allocated ahead, if there is one
+    uint64_t SSBTree::allocNode()
+    {
+        uint64_t off = spareNode.load();
+        if (off > spareBusy && spareNode.compare_exchange_strong(off, spareBusy))
+        {
+            //the caller links the node: recovery must not free it any more
+            spareOid.off = 0;
+            Node::clflush(pop, (char *)&spareOid, sizeof(PMEMoid), false, true);
+            spareNode.store(0);
+        }
+        else
+        {
+            PMEMoid oid;
+            pmemobj_xalloc(pop, &oid, sizeof(Node), 0, POBJ_CLASS_ID(128), NULL, NULL);
+            off = oid.off;
+        }
+        TOID(Node) nodeoid = tailoid;
+        nodeoid.oid.off = off;
+        clear_counts(D_RW(nodeoid));
+        return off;
+    }
+
+    //allocate the node of the next split outside of any lock; the allocation sets spareOid
+    //in the same failure-atomic step, so a crash never loses the node
+    void SSBTree::reserveNode()
+    {
+        uint64_t expected = 0;
+        if (spareNode.load(std::memory_order_relaxed) || !spareNode.compare_exchange_strong(expected, spareBusy))
+            return;
+        pmemobj_xalloc(pop, &spareOid, sizeof(Node), 0, POBJ_CLASS_ID(128), NULL, NULL);
+        spareNode.store(spareOid.off);
+    }
+
+    //pairs the left node keeps out of count.
+    //Ascending keys only ever fill the left node of a split and descending keys the right one,
+    //so a node that grew at one edge leaves the node that will not grow nearly full.
+    static inline uint64_t split_point(uint64_t count, int edge)
+    {
+        uint64_t small = std::max<uint64_t>(2, count / 10);
+        if (edge == 0 || count < 2 * small)
+            return (count + 1) >> 1; //the left node keeps the larger half, so tiny nodes still fan out
+        return edge > 0 ? count - small : small;
+    }
+
+    //insertKey is the key whose insert filled the node
+    void SSBTree::split(Node *node, const Key &insertKey)
     {
         uint64_t header = node -> header;
         uint64_t num = getNum(header);
-        if (num < maxPairsLength) return;
+        if (num < pairsLength(header)) return;
+        if (getExtra(header))
+        {
+            boxMerge(node, header, nullptr, nullptr);
+            header = node->header;
+        }
         int lazyflag = (header >> shiflazybox) & 3;
 
         uint64_t end = num - lazydiff[lazyflag] - 1 ;
-        Pair *offset_pair = &node->pairs[0];
-        if (versionTurn(header))
-        {
-            offset_pair = &node->pairs[maxPairsLength];
-        }
+        PairPtr offset_pair = node->half(versionTurn(header));
 
-        TOID(Node) newoid;
-        pmemobj_xalloc(this->pop, &newoid.oid, sizeof(Node), 0, POBJ_CLASS_ID(128), NULL, NULL);
+        TOID(Node) newoid = headoid;
+        newoid.oid.off = allocNode();
         Node *newnode = D_RW(newoid);
 
         pmemobj_mutex_zero(pop, &newnode->mutex);
+        newnode->header = header & BOTTOM_BITS; //selects the layout of newnode->half()
         newnode ->right[rightTurn(header)] = node ->right[rightTurn(header)];
         newnode ->maxKey[rightTurn(header)] = node ->maxKey[rightTurn(header)];
 
         uint64_t newhead1, newhead2;
 
-        uint64_t mid = (end + 1) >> 1;
-
-        memcpy(newnode->pairs, offset_pair + mid , (end - mid + 1)*sizeof(Pair));
-        newnode->midkey[0] = newnode->pairs[midindex].key;
+        //the minKey of a level head stays in front of every insert
+        uint64_t first = offset_pair[0].key == KeyTraits::minKey;
+        int edge = 0;
+        if (lazyflag == 1 && node->LazyBox.key == insertKey)
+            edge = node->lazyPosition <= first ? -1 : 0;
+        else if (offset_pair[end].key == insertKey && !(lazyflag == 1 && node->LazyBox.key > insertKey))
+            edge = 1;
+        else if (offset_pair[first].key == insertKey && !(lazyflag == 1 && node->lazyPosition <= first))
+            edge = -1;
+        uint64_t mid = split_point(end + 1, edge);
+
+        PairPtr new_pair = newnode->half(0);
+        copy_pairs(new_pair, offset_pair + mid, end - mid + 1);
+        newnode->midkey[0] = new_pair[midindex].key;
         newhead1 = (header - ((end - mid + 1) << shifnumber)) ;
         Node::addRight(newhead1);
         newhead2 = (header & (~(LOCK_BITS | NUM_BITS | VERSION_BITS))) + ((end - mid + 1) << shifnumber); //unock&num
@@ -471,11 +1147,10 @@ int64_t x:
         if (lazyflag)
         {
             newnode->LazyBox = node ->LazyBox;
-            if (newnode->LazyBox.key >= newnode->pairs[0].key)
+            newnode->lazyPosition = node->lazyPosition;
+            if (newnode->LazyBox.key >= new_pair[0].key)
             {
-                uint64_t v = reinterpret_cast<uint64_t>(newnode->LazyBox.value);
-                uint32_t w1 = ((v ^ signextend(v)) >> highPosition) - mid;
-                newnode->LazyBox.value = signextend(v) ^ ((uint64_t)w1 << highPosition);
+                newnode->lazyPosition -= mid;
 
                 newhead1 = newhead1 ^ (newhead1 & BOX_BITS);
                 if (lazyflag == 0x1)
@@ -493,12 +1168,13 @@ int64_t x:
         }
 
         newnode->header = (newhead2);
-        Node::clflush(pop, (char *)newnode, NodeSize - maxPairsLength * sizeof(Pair) - sizeof(Pair) - cache_line_size, false, false);
+        set_fingerprints(pop, newnode, newhead2, 0, 0, end - mid);
+        Node::clflush(pop, (char *)newnode, (char *)&newnode->half(1)[0].key - (char *)newnode, false, false);
 
         node->right[rightTurn(newhead1)] = newoid.oid.off;
         Node::clflush(pop, (char *)&node->right, sizeof(Pair), false, false);
 
-        node->maxKey[rightTurn(newhead1)] = newnode->pairs[0].key;
+        node->maxKey[rightTurn(newhead1)] = new_pair[0].key;
         node->header = (newhead1);
         Node::clflush(pop, (char *)node, cache_line_size, true, true);
     }
@@ -528,137 +1204,974 @@ int64_t x:
             return;
         }
 
-        if (getNum(header) + getNum(sibling_header) >= Lnum)
+        if (getLoad(header) + getLoad(sibling_header) >= Lnum)
+        {
+            pmemobj_mutex_unlock(pop, &node->mutex);
+            pmemobj_mutex_unlock(pop, &sibling->mutex);
+            return;
+        }
+
+        if (isCompact(header))
+            compactMerge(node, sibling, header, sibling_header);
+        else
+        {
+            //extra boxes have no position to merge at
+            if (getExtra(header))
+            {
+                boxMerge(node, header, nullptr, nullptr);
+                header = node->header;
+            }
+            if (getExtra(sibling_header))
+            {
+                boxMerge(sibling, sibling_header, nullptr, nullptr);
+                sibling_header = sibling->header;
+            }
+            int lazyflag1 = (header >> shiflazybox) & 3;
+            int lazyflag2 = (sibling_header >> shiflazybox) & 3;
+            int end1 = getNum(header) - 1 - lazydiff[lazyflag1];
+            int oldend = end1;
+            int end2 = getNum(sibling_header) - 1 - lazydiff[lazyflag2];
+            PairPtr offset_pair = node->half(versionTurn(header));
+
+            PairPtr sibling_pair = sibling->half(versionTurn(sibling_header));
+            int w = -1;
+
+            if (lazyflag2)
+                w = sibling->lazyPosition;
+
+            for (int i = 0 ; i < w; i++)
+            {
+                offset_pair[++end1] = sibling_pair[i];
+            }
+
+            if (lazyflag2 == 1) //insert
+            {
+                offset_pair[++end1].key = sibling->LazyBox.key;
+                offset_pair[end1].value = sibling->LazyBox.value;
+            }
+            else w++;
+
+            for (int i = w ; i <= end2; i++)
+            {
+                offset_pair[++end1] = sibling_pair[i];
+            }
+
+            clflush_pairs(pop, offset_pair + (oldend + 1), end1 - oldend);
+            set_fingerprints(pop, node, header, versionTurn(header), oldend + 1, end1);
+
+            uint64_t newheader = header  + addNum_BITS * (end1 - oldend);
+            Node::addRight(newheader);
+
+            node->right[rightTurn(newheader)] = sibling->right[rightTurn(sibling_header)];
+            Node::clflush(pop, (char *)&node->right, cache_line_size, false, false);
+
+            node->midkey[versionTurn(newheader)] = offset_pair[midindex].key;
+            node->maxKey[rightTurn(newheader)] = sibling->maxKey[rightTurn(sibling_header)];
+            node->header = newheader;
+            Node::clflush(pop, (char *)&node->header, cache_line_size, true, true);
+        }
+
+        uint64_t rightmost = sibloid.oid.off;
+        rightmostLeaf.compare_exchange_strong(rightmost, 0);
+        epoche->markNodeForDeletion((void *)sibling, threadEpocheInfo);
+        sibling->header = (sibling_header | DEL_BITS);
+        //Node::clflush(pop,(char *)&sibling->header,sizeof(uint64_t),false,true);
+        pmemobj_mutex_unlock(pop, &node->mutex);
+        pmemobj_mutex_unlock(pop, &sibling->mutex);
+    }
+
+    /**************************************compact bottom nodes**************************************************************/
+    // A compact bottom node keeps one pair array that is never rewritten in place.
+    // Its sorted order is a slot array of pair indices, double-buffered by slotTurn.
+    // A writer fills a free pair and the inactive slot array, then adds two versions
+    // to the header. This flips slotTurn and also fails ReadcheckVesion for readers
+    // of the old order.
+
+    //slot bytes read without the lock may be torn; keep them inside the node until the version check
+    static inline Pair &compact_pair(Node *node, const uint8_t *slots, int r)
+    {
+        return node->compact.pairs[slots[r] % compactPairsLength];
+    }
+
+    //return the upper-bound's rank among n sorted slots
+    static inline int compact_search(Node *node, const uint8_t *slots, int n, const Key findkey)
+    {
+        int lo = 0, hi = n;
+        while (lo < hi)
+        {
+            int mid = (lo + hi) >> 1;
+            if (compact_pair(node, slots, mid).key > findkey) hi = mid;
+            else lo = mid + 1;
+        }
+        return lo;
+    }
+
+    static inline uint64_t compact_used(const uint8_t *slots, int n)
+    {
+        uint64_t used = 0;
+        for (int i = 0; i < n; i++)
+            used |= 1ULL << slots[i];
+        return used;
+    }
+
+    void SSBTree::compactUpKey(Node *node, uint64_t header, Pair &upPair)
+    {
+        int n = getNum(header);
+        uint8_t *slots = node->compact.slots[slotTurn(header)];
+        uint8_t *next = node->compact.slots[slotTurn(header) ^ 1];
+
+        int w = __builtin_ctzll(~compact_used(slots, n));
+        node->compact.pairs[w] = upPair;
+        Node::clflush(pop, (char *)&node->compact.pairs[w], sizeof(Pair), false, false);
+
+        int k = compact_search(node, slots, n, upPair.key);
+        memcpy(next, slots, k);
+        next[k] = w;
+        memcpy(next + k + 1, slots + k, n - k);
+        Node::clflush(pop, (char *)next, n + 1, false, false);
+
+        node->header = (header + 2 * addVersion_BITS + addNum_BITS);
+        Node::clflush(pop, (char *) &node->header, sizeof(uint64_t), true, true);
+        compactSplit(node, upPair.key);
+    }
+
+    bool SSBTree::compactDownKey(Node *node, uint64_t header, const Key downkey, uint64_t &removed)
+    {
+        int n = getNum(header);
+        uint8_t *slots = node->compact.slots[slotTurn(header)];
+        uint8_t *next = node->compact.slots[slotTurn(header) ^ 1];
+
+        int k = compact_search(node, slots, n, downkey) - 1;
+        if (k < 0 || compact_pair(node, slots, k).key != downkey)
+            return false;
+        removed = compact_pair(node, slots, k).value;
+        memcpy(next, slots, k);
+        memcpy(next + k, slots + k + 1, n - k - 1);
+        Node::clflush(pop, (char *)next, n - 1, false, false);
+
+        node->header = (header + 2 * addVersion_BITS - addNum_BITS);
+        Node::clflush(pop, (char *) &node->header, sizeof(uint64_t), true, true);
+        return true;
+    }
+
+    void SSBTree::compactSplit(Node *node, const Key &insertKey)
+    {
+        uint64_t header = node -> header;
+        uint64_t num = getNum(header);
+        if (num < compactPairsLength) return;
+        uint8_t *slots = node->compact.slots[slotTurn(header)];
+
+        TOID(Node) newoid = headoid;
+        newoid.oid.off = allocNode();
+        Node *newnode = D_RW(newoid);
+
+        pmemobj_mutex_zero(pop, &newnode->mutex);
+        newnode ->right[rightTurn(header)] = node ->right[rightTurn(header)];
+        newnode ->maxKey[rightTurn(header)] = node ->maxKey[rightTurn(header)];
+
+        int first = compact_pair(node, slots, 0).key == KeyTraits::minKey;
+        int edge = compact_pair(node, slots, num - 1).key == insertKey ? 1 : compact_pair(node, slots, first).key == insertKey ? -1 : 0;
+        //the left node keeps a prefix of its slot order, so no new version is needed
+        uint64_t mid = split_point(num, edge);
+        for (uint64_t i = mid; i < num; i++)
+        {
+            newnode->compact.pairs[i - mid] = node->compact.pairs[slots[i]];
+            newnode->compact.slots[0][i - mid] = i - mid;
+        }
+        uint64_t newhead1 = (header - ((num - mid) << shifnumber)) ;
+        Node::addRight(newhead1);
+        uint64_t newhead2 = (header & (~(LOCK_BITS | NUM_BITS | VERSION_BITS))) + ((num - mid) << shifnumber);
+
+        newnode->header = (newhead2);
+        Node::clflush(pop, (char *)newnode, (char *)&newnode->compact.pairs[num - mid] - (char *)newnode, false, false);
+
+        node->right[rightTurn(newhead1)] = newoid.oid.off;
+        Node::clflush(pop, (char *)&node->right, sizeof(Pair), false, false);
+
+        node->maxKey[rightTurn(newhead1)] = newnode->compact.pairs[0].key;
+        node->header = (newhead1);
+        Node::clflush(pop, (char *)node, cache_line_size, true, true);
+    }
+
+    //both nodes are locked by merge
+    void SSBTree::compactMerge(Node *node, Node *sibling, uint64_t header, uint64_t sibling_header)
+    {
+        int n1 = getNum(header);
+        int n2 = getNum(sibling_header);
+        uint8_t *slots = node->compact.slots[slotTurn(header)];
+        uint8_t *next = node->compact.slots[slotTurn(header) ^ 1];
+        uint8_t *sibling_slots = sibling->compact.slots[slotTurn(sibling_header)];
+
+        uint64_t used = compact_used(slots, n1);
+        memcpy(next, slots, n1);
+        for (int i = 0; i < n2; i++)
+        {
+            int w = __builtin_ctzll(~used);
+            used |= 1ULL << w;
+            node->compact.pairs[w] = sibling->compact.pairs[sibling_slots[i]];
+            Node::clflush(pop, (char *)&node->compact.pairs[w], sizeof(Pair), false, false);
+            next[n1 + i] = w;
+        }
+        Node::clflush(pop, (char *)next, n1 + n2, false, false);
+
+        uint64_t newheader = header + 2 * addVersion_BITS + addNum_BITS * n2;
+        Node::addRight(newheader);
+
+        node->right[rightTurn(newheader)] = sibling->right[rightTurn(sibling_header)];
+        Node::clflush(pop, (char *)&node->right, cache_line_size, false, false);
+
+        node->maxKey[rightTurn(newheader)] = sibling->maxKey[rightTurn(sibling_header)];
+        node->header = newheader;
+        Node::clflush(pop, (char *)&node->header, cache_line_size, true, true);
+    }
+
+    //copy the pairs p[from..to-1] with minscan <= key <= maxscan to out and return their count;
+    //the keys of a half are sorted, so the copy stops at the first key past maxscan
+    static inline int range_pairs(PairPtr p, int from, int to, const Key &minscan, const Key &maxscan, Pair *out)
+    {
+        int n = 0;
+#if defined(USE_AVX512) && KEY_BITS == 64 && !defined(STRING_KEY)
+        //compare a vector of keys against both bounds and compress-store the pairs in range
+        const __m512i lo = _mm512_set1_epi64(minscan);
+        const __m512i hi = _mm512_set1_epi64(maxscan);
+#ifdef SOA_LAYOUT
+        const __m512i first = _mm512_set_epi64(11, 3, 10, 2, 9, 1, 8, 0);
+        const __m512i second = _mm512_set_epi64(15, 7, 14, 6, 13, 5, 12, 4);
+        for (int i = from; i < to; i += 8)
+        {
+            int left = to - i;
+            __mmask8 valid = left >= 8 ? 0xFF : (1 << left) - 1;
+            __m512i keys = _mm512_maskz_loadu_epi64(valid, &p.keys[i]);
+            __m512i values = _mm512_maskz_loadu_epi64(valid, &p.values[i]);
+            __mmask8 in = _mm512_mask_cmpge_epu64_mask(valid, keys, lo) & _mm512_mask_cmple_epu64_mask(valid, keys, hi);
+            //interleave keys and values into pairs; a key bit covers both lanes of its pair
+            __mmask8 in0 = _pdep_u32(in & 0xF, 0x55) * 3, in1 = _pdep_u32(in >> 4, 0x55) * 3;
+            _mm512_mask_compressstoreu_epi64(&out[n], in0, _mm512_permutex2var_epi64(keys, first, values));
+            n += __builtin_popcount(in & 0xF);
+            _mm512_mask_compressstoreu_epi64(&out[n], in1, _mm512_permutex2var_epi64(keys, second, values));
+            n += __builtin_popcount(in >> 4);
+            if (_mm512_mask_cmpgt_epu64_mask(valid, keys, hi)) break;
+        }
+#else
+        for (int i = from; i < to; i += 4)
+        {
+            int left = to - i;
+            __mmask8 valid = left >= 4 ? 0xFF : (1 << (left << 1)) - 1;
+            __m512i data = _mm512_maskz_loadu_epi64(valid, &p[i].key);
+            __mmask8 in = _mm512_mask_cmpge_epu64_mask(valid & 0x55, data, lo) & _mm512_mask_cmple_epu64_mask(valid & 0x55, data, hi);
+            _mm512_mask_compressstoreu_epi64(&out[n], in | in << 1, data);
+            n += __builtin_popcount(in);
+            if (_mm512_mask_cmpgt_epu64_mask(valid & 0x55, data, hi)) break;
+        }
+#endif
+#else
+        for (int i = from; i < to; i++)
+            if (p[i].key >= minscan)
+            {
+                if (p[i].key > maxscan) break;
+                out[n++] = p[i];
+            }
+#endif
+        return n;
+    }
+
+    //the pairs in [minscan, maxscan] of a bottom node as of header, not validated
+    static inline int leaf_pairs(Node *node, uint64_t header, const Key &minscan, const Key &maxscan, Pair *pairs)
+    {
+        int n = 0;
+        if (isCompact(header))
+        {
+            int num = getNum(header);
+            const uint8_t *slots = node->compact.slots[slotTurn(header)];
+            int i = compact_search(node, slots, num, minscan);
+            if (i > 0 && compact_pair(node, slots, i - 1).key == minscan) i--;
+            for (; i < num; i++)
+            {
+                Pair &pair = compact_pair(node, slots, i);
+                if (pair.key > maxscan) break;
+                pairs[n++] = pair;
+            }
+        }
+        else if (getExtra(header))
+        {
+            //the LazyBox holds an insert too: merge the array with the sorted boxes
+            Pair boxes[lazySlots];
+            int nbox = collect_boxes(node, header, boxes);
+            int end = getNum(header) - 1 - lazydiff[1] - getExtra(header);
+            PairPtr offset_pair = node->half(versionTurn(header));
+            for (int i = 0, b = 0; i <= end || b < nbox;)
+            {
+                Pair pair;
+                if (b == nbox || (i <= end && offset_pair[i].key < boxes[b].key))
+                    pair = offset_pair[i++];
+                else
+                    pair = boxes[b++];
+                if (pair.key < minscan) continue;
+                if (pair.key > maxscan) break;
+                pairs[n++] = pair;
+            }
+        }
+        else
+        {
+            int num = getNum(header) ;
+            int lazyflag = (header >> shiflazybox) & 0x3;
+
+            Pair lazybox = node->LazyBox;
+            num -= lazydiff[lazyflag] + getExtra(header);
+
+            PairPtr offset_pair = node->half(versionTurn(header));
+
+            int w = -1;
+
+            if (lazyflag)
+                w = node->lazyPosition;
+
+            n += range_pairs(offset_pair, 0, w, minscan, maxscan, pairs + n);
+            if (lazyflag == 1 && lazybox.key >= minscan && lazybox.key <= maxscan)
+                pairs[n++] = lazybox;
+            if (lazyflag != 1) w++;
+            n += range_pairs(offset_pair, w, num, minscan, maxscan, pairs + n);
+        }
+        return n;
+    }
+
+    //the first bottom node starts with the reserved minKey, which no range hands out
+    static inline int drop_min_key(Pair *pairs, int n)
+    {
+        if (n > 0 && pairs[0].key == KeyTraits::minKey)
+            std::copy(pairs + 1, pairs + n--, pairs);
+        return n;
+    }
+
+    static inline void add_value(Aggregate &agg, uint64_t value)
+    {
+        agg.count++;
+        agg.sum += value;
+        agg.min = std::min(agg.min, value);
+        agg.max = std::max(agg.max, value);
+    }
+
+    //fold the values of p[from..to-1] with minscan <= key <= maxscan into agg, as range_pairs copies them
+    static inline void range_aggregate(PairPtr p, int from, int to, const Key &minscan, const Key &maxscan, Aggregate &agg)
+    {
+#if defined(USE_AVX512) && KEY_BITS == 64 && !defined(STRING_KEY)
+        //masked lanes of the values in range are added and compared, and reduced once per half
+        const __m512i lo = _mm512_set1_epi64(minscan);
+        const __m512i hi = _mm512_set1_epi64(maxscan);
+        __m512i sum = _mm512_setzero_si512(), mn = _mm512_set1_epi64(-1), mx = _mm512_setzero_si512();
+        uint64_t count = 0;
+#ifdef SOA_LAYOUT
+        for (int i = from; i < to; i += 8)
+        {
+            int left = to - i;
+            __mmask8 valid = left >= 8 ? 0xFF : (1 << left) - 1;
+            __m512i keys = _mm512_maskz_loadu_epi64(valid, &p.keys[i]);
+            __mmask8 in = _mm512_mask_cmpge_epu64_mask(valid, keys, lo) & _mm512_mask_cmple_epu64_mask(valid, keys, hi);
+            __m512i values = _mm512_maskz_loadu_epi64(in, &p.values[i]);
+            sum = _mm512_mask_add_epi64(sum, in, sum, values);
+            mn = _mm512_mask_min_epu64(mn, in, mn, values);
+            mx = _mm512_mask_max_epu64(mx, in, mx, values);
+            count += __builtin_popcount(in);
+            if (_mm512_mask_cmpgt_epu64_mask(valid, keys, hi)) break;
+        }
+#else
+        for (int i = from; i < to; i += 4)
+        {
+            int left = to - i;
+            __mmask8 valid = left >= 4 ? 0xFF : (1 << (left << 1)) - 1;
+            __m512i data = _mm512_maskz_loadu_epi64(valid, &p[i].key);
+            //a key lane in range selects the value lane after it
+            __mmask8 in = _mm512_mask_cmpge_epu64_mask(valid & 0x55, data, lo) & _mm512_mask_cmple_epu64_mask(valid & 0x55, data, hi);
+            sum = _mm512_mask_add_epi64(sum, in << 1, sum, data);
+            mn = _mm512_mask_min_epu64(mn, in << 1, mn, data);
+            mx = _mm512_mask_max_epu64(mx, in << 1, mx, data);
+            count += __builtin_popcount(in);
+            if (_mm512_mask_cmpgt_epu64_mask(valid & 0x55, data, hi)) break;
+        }
+#endif
+        if (count)
+        {
+            //the lanes are folded from memory: the _mm512_reduce_* sequences warn of uninitialized vectors in gcc
+            alignas(64) uint64_t sums[8], mins[8], maxs[8];
+            _mm512_store_si512(sums, sum);
+            _mm512_store_si512(mins, mn);
+            _mm512_store_si512(maxs, mx);
+            agg.count += count;
+            for (int l = 0; l < 8; l++)
+            {
+                agg.sum += sums[l];
+                agg.min = std::min(agg.min, mins[l]);
+                agg.max = std::max(agg.max, maxs[l]);
+            }
+        }
+#else
+        for (int i = from; i < to; i++)
+            if (p[i].key >= minscan)
+            {
+                if (p[i].key > maxscan) break;
+                add_value(agg, p[i].value);
+            }
+#endif
+    }
+
+    //the aggregate of the pairs in [minscan, maxscan] of a bottom node as of header, not validated;
+    //the reserved minKey of the first bottom node is left out
+    static inline void leaf_aggregate(Node *node, uint64_t header, const Key &minscan, const Key &maxscan, Aggregate &agg)
+    {
+        if (isCompact(header) || getExtra(header))
+        {
+            //slots and merged boxes are not contiguous: fold the pairs of leaf_pairs
+            Pair pairs[leafPairsLength];
+            int n = drop_min_key(pairs, leaf_pairs(node, header, minscan, maxscan, pairs));
+            for (int i = 0; i < n; i++)
+                add_value(agg, pairs[i].value);
+            return;
+        }
+        int num = getNum(header);
+        int lazyflag = (header >> shiflazybox) & 0x3;
+        Pair lazybox = node->LazyBox;
+        num -= lazydiff[lazyflag];
+        PairPtr offset_pair = node->half(versionTurn(header));
+        int first = num > 0 && offset_pair[0].key == KeyTraits::minKey;
+        int w = -1;
+        if (lazyflag)
+            w = node->lazyPosition;
+        range_aggregate(offset_pair, first, w, minscan, maxscan, agg);
+        if (lazyflag == 1 && lazybox.key >= minscan && lazybox.key <= maxscan)
+            add_value(agg, lazybox.value);
+        if (lazyflag != 1) w++;
+        range_aggregate(offset_pair, std::max(w, first), num, minscan, maxscan, agg);
+    }
+
+    int SSBTree::leafPairs(TOID(Node) &nodeoid, const Key minscan, const Key maxscan, Pair *pairs)
+    {
+        while (true)
+        {
+            Node *node = D_RW(nodeoid);
+            uint64_t header = node->header;
+            int n = leaf_pairs(node, header, minscan, maxscan, pairs);
+            //the half being read may be rewritten by a second writer: read the node again
+            if (!Node::ReadcheckVesion(header, node->header))
+                continue;
+            if (node->maxKey[rightTurn(header)] > maxscan)
+                nodeoid = tailoid;
+            else
+                nodeoid.oid.off = node->right[rightTurn(header)];
+            return drop_min_key(pairs, n);
+        }
+    }
+
+    void SSBTree::leafscan(TOID(Node) nodeoid, const Key minscan, const Key maxscan, int length, uint64_t *results, int &offset)
+    {
+        Pair pairs[leafPairsLength];
+        while(nodeoid.oid.off != tailoid.oid.off && offset < length)
+        {
+            int n = leafPairs(nodeoid, minscan, maxscan, pairs);
+            for (int i = 0; i < n && offset < length; i++)
+                results[offset++] = pairs[i].value;
+        }
+    }
+
+
+    //pairs the node can hand out at once are written to results in place
+    void SSBTree::scan(const Key minscan, const Key maxscan, int length, Pair *results, int &offset, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        Pair pairs[leafPairsLength];
+        TOID(Node) nodeoid;
+        search(minscan, nodeoid, threadEpocheInfo);
+        while (nodeoid.oid.off != tailoid.oid.off && offset < length)
+        {
+            if (length - offset >= (int)leafPairsLength)
+            {
+                offset += leafPairs(nodeoid, minscan, maxscan, results + offset);
+                continue;
+            }
+            int n = std::min(leafPairs(nodeoid, minscan, maxscan, pairs), length - offset);
+            std::copy(pairs, pairs + n, results + offset);
+            offset += n;
+        }
+    }
+
+    void SSBTree::scanLeaves(const Key minscan, const Key maxscan, bool (*leaf)(void *, const Pair *, int), void *ctx, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        Pair pairs[leafPairsLength];
+        TOID(Node) nodeoid;
+        search(minscan, nodeoid, threadEpocheInfo);
+        while (nodeoid.oid.off != tailoid.oid.off)
+        {
+            int n = leafPairs(nodeoid, minscan, maxscan, pairs);
+            if (n > 0 && !leaf(ctx, pairs, n))
+                return;
+        }
+    }
+
+
+    Aggregate SSBTree::aggregate(const Key minscan, const Key maxscan, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        Aggregate agg;
+        TOID(Node) nodeoid;
+        search(minscan, nodeoid, threadEpocheInfo);
+        while (nodeoid.oid.off != tailoid.oid.off)
+        {
+            Node *node = D_RW(nodeoid);
+            uint64_t header = node->header;
+            Aggregate part;
+            leaf_aggregate(node, header, minscan, maxscan, part);
+            if (!Node::ReadcheckVesion(header, node->header))
+                continue;
+            agg.count += part.count;
+            agg.sum += part.sum;
+            agg.min = std::min(agg.min, part.min);
+            agg.max = std::max(agg.max, part.max);
+            if (node->maxKey[rightTurn(header)] > maxscan)
+                break;
+            nodeoid.oid.off = node->right[rightTurn(header)];
+        }
+        return agg;
+    }
+
+    //Every bottom node of the range is read once, validated on its own as in leafscan, and
+    //remembered with its header. Once all are read, the headers are compared again: if none
+    //changed, no writer touched the range in between and the pairs are one state of it.
+    //Writers are never held up; a scan that lost the race is retried up to tries times.
+    bool SSBTree::snapshotScan(const Key minscan, const Key maxscan, int length, Pair *results, int &offset, ThreadInfo &threadEpocheInfo, int tries)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        Pair pairs[leafPairsLength];
+        std::vector<std::pair<Node *, uint64_t>> read;
+        int start = offset;
+        for (int attempt = 0; attempt < tries; attempt++)
+        {
+            offset = start;
+            read.clear();
+            TOID(Node) nodeoid;
+            search(minscan, nodeoid, threadEpocheInfo);
+            while (nodeoid.oid.off != tailoid.oid.off && offset < length)
+            {
+                Node *node = D_RW(nodeoid);
+                uint64_t header = node->header;
+                int n = leaf_pairs(node, header, minscan, maxscan, pairs);
+                if (!Node::ReadcheckVesion(header, node->header))
+                    continue;
+                read.emplace_back(node, header);
+                n = std::min(drop_min_key(pairs, n), length - offset);
+                std::copy(pairs, pairs + n, results + offset);
+                offset += n;
+                if (node->maxKey[rightTurn(header)] > maxscan)
+                    break;
+                nodeoid.oid.off = node->right[rightTurn(header)];
+            }
+            bool same = true;
+            for (auto &r : read)
+                same = same && r.first->header == r.second;
+            if (same)
+                return true;
+        }
+        return false;
+    }
+
+    //Separator keys in (minscan, maxscan), from the highest inner level that holds at least want
+    //of them, thinned out to want evenly spaced keys. Separators may be stale; they only cut the range.
+    std::vector<Key> SSBTree::rangeSplits(const Key minscan, const Key maxscan, size_t want)
+    {
+        std::vector<Key> keys;
+        TOID(Node) leveloid = rootoid;
+        while (!isBottom(D_RW(leveloid)->header))
+        {
+            keys.clear();
+            TOID(Node) nodeoid = leveloid;
+            bool above = false;
+            while (true)
+            {
+                Node *node = D_RW(nodeoid);
+                uint64_t header = node->header;
+                size_t size = keys.size();
+                Key maxKey = node->maxKey[rightTurn(header)];
+                if (maxKey > minscan)
+                {
+                    int lazyflag = (header >> shiflazybox) & 3;
+                    int end = getNum(header) - 1 - lazydiff[lazyflag];
+                    PairPtr offset_pair = node->half(versionTurn(header));
+                    for (int i = 0; i <= end; i++)
+                        if (offset_pair[i].key > minscan && offset_pair[i].key < maxscan)
+                            keys.push_back(offset_pair[i].key);
+                    Pair lazybox = node->LazyBox;
+                    if (lazyflag == 1 && lazybox.key > minscan && lazybox.key < maxscan)
+                        keys.push_back(lazybox.key);
+                    //the first node of the range also gives the node of minscan one level down
+                    uint64_t child = 0;
+                    Key low;
+                    bool present;
+                    if (above ? !Node::ReadcheckVesion(header, node->header) : !readNode(node, header, minscan, false, child, low, present))
+                    {
+                        keys.resize(size);
+                        continue;
+                    }
+                    if (!above)
+                    {
+                        leveloid.oid.off = child;
+                        above = true;
+                    }
+                }
+                if (maxKey >= maxscan)
+                    break;
+                nodeoid.oid.off = node->right[rightTurn(header)];
+            }
+            if (keys.size() >= want)
+                break;
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        if (keys.size() > want)
+        {
+            std::vector<Key> even(want);
+            for (size_t i = 0; i < want; i++)
+                even[i] = keys[(i + 1) * keys.size() / (want + 1)];
+            keys.swap(even);
+        }
+        return keys;
+    }
+
+    //ranges per thread, so that threads with short ranges pick up more of them
+    static constexpr int partsPerThread = 4;
+
+    size_t SSBTree::parallelLeaves(const Key minscan, const Key maxscan, bool (*leaf)(void *, size_t, const Pair *, int), void *ctx, int nThreads)
+    {
+        nThreads = std::max(1, nThreads);
+        std::vector<Key> splits;
+        {
+            ThreadInfo threadEpocheInfo = getThreadInfo();
+            EpocheGuard epocheGuard(threadEpocheInfo);
+            splits = rangeSplits(minscan, maxscan, nThreads * partsPerThread - 1);
+        }
+        struct Part
+        {
+            bool (*leaf)(void *, size_t, const Pair *, int);
+            void *ctx;
+            size_t part;
+            const Key *end; //first key of the next part
+        };
+        size_t parts = splits.size() + 1;
+        tbb::task_arena arena(nThreads);
+        arena.execute([&]
+        {
+            tbb::parallel_for(size_t(0), parts, [&](size_t i)
+            {
+                ThreadInfo threadEpocheInfo = getThreadInfo();
+                Part part{leaf, ctx, i, i < splits.size() ? &splits[i] : nullptr};
+                scanLeaves(i ? splits[i - 1] : minscan, part.end ? *part.end : maxscan, [](void *p, const Pair *pairs, int n)
+                {
+                    Part &part = *(Part *)p;
+                    if (part.end)
+                        while (n > 0 && pairs[n - 1].key >= *part.end) n--;
+                    return n == 0 || part.leaf(part.ctx, part.part, pairs, n);
+                }, &part, threadEpocheInfo);
+            }, tbb::simple_partitioner());
+        });
+        return parts;
+    }
+
+    //the pairs of the bottom node holding x, or with strict of the node holding the keys just below x,
+    //and the bounds [low, high) of its keys; nodes are found by separator keys, not by links, so
+    //callers may keep the bounds across epochs
+    int SSBTree::leafAt(const Key x, bool strict, Pair *pairs, Key &low, Key &high)
+    {
+restart:
+        TOID(Node) nodeoid = rootoid;
+        low = KeyTraits::minKey;
+        while (true)
+        {
+            Node *node = D_RW(nodeoid);
+            uint64_t header = node->header;
+            Key maxKey = node->maxKey[rightTurn(header)];
+            if (maxKey < x || (!strict && maxKey == x))
+            {
+                low = maxKey;
+                nodeoid.oid.off = node->right[rightTurn(header)];
+                if (!Node::RightCheck(node->header, header))
+                    goto restart;
+                continue;
+            }
+            if (isBottom(header))
+            {
+                int n = leaf_pairs(node, header, KeyTraits::minKey, KeyTraits::maxKey, pairs);
+                if (!Node::ReadcheckVesion(header, node->header))
+                    goto restart;
+                high = maxKey;
+                return n;
+            }
+            uint64_t child;
+            bool present;
+            if (!readNode(node, header, x, strict, child, low, present))
+                goto restart;
+            nodeoid.oid.off = child;
+        }
+    }
+
+    //pairs[0..n-1] below key
+    static inline int lower_rank(const Pair *pairs, int n, const Key &key)
+    {
+        return std::lower_bound(pairs, pairs + n, key, [](const Pair &p, const Key &k)
         {
-            pmemobj_mutex_unlock(pop, &node->mutex);
-            pmemobj_mutex_unlock(pop, &sibling->mutex);
-            return;
-        }
+            return p.key < k;
+        }) - pairs;
+    }
 
-        int lazyflag1 = (header >> shiflazybox) & 3;
-        int lazyflag2 = (sibling_header >> shiflazybox) & 3;
-        int end1 = getNum(header) - 1 - lazydiff[lazyflag1];
-        int oldend = end1;
-        int end2 = getNum(sibling_header) - 1 - lazydiff[lazyflag2];
-        Pair *offset_pair = &node->pairs[0];
-        if (versionTurn(header))
+    //there is no left link: the node before a bottom node is found again from the root
+    //as the one holding the keys just below the low bound of the node
+    void SSBTree::scanLeavesBack(const Key minscan, const Key maxscan, bool (*leaf)(void *, const Pair *, int), void *ctx, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        Pair pairs[leafPairsLength];
+        Key x = maxscan, low, high;
+        bool strict = false;
+        while (true)
         {
-            offset_pair = &node->pairs[maxPairsLength];
+            int n = drop_min_key(pairs, leafAt(x, strict, pairs, low, high));
+            int to = strict ? lower_rank(pairs, n, x) : n;
+            while (to > 0 && pairs[to - 1].key > maxscan) to--;
+            int from = lower_rank(pairs, to, minscan);
+            if (from < to && !leaf(ctx, pairs + from, to - from))
+                return;
+            if (low <= minscan)
+                return;
+            x = low;
+            strict = true;
         }
+    }
 
-        Pair *sibling_pair  = &sibling->pairs[0];
-        if (versionTurn(sibling_header))
-        {
-            sibling_pair = &sibling_pair[maxPairsLength];
-        }
-        int w = -1;
-        uint64_t v = reinterpret_cast<uint64_t>(sibling->LazyBox.value);
+    SSBTree::Iterator::Iterator(SSBTree &tree, ThreadInfo &threadEpocheInfo)
+        : tree(tree), threadEpocheInfo(threadEpocheInfo), n(0), pos(0)
+    {
+    }
 
-        if (lazyflag2)
-            w = (v ^ signextend(v)) >> highPosition;
+    //buffer the node holding x (strict: the keys just below x) and return the rank of x in it
+    int SSBTree::Iterator::load(const Key x, bool strict)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        n = drop_min_key(pairs, tree.leafAt(x, strict, pairs, low, high));
+        return lower_rank(pairs, n, x);
+    }
 
-        for (int i = 0 ; i < w; i++)
+    bool SSBTree::Iterator::forward()
+    {
+        while (pos >= n)
         {
-            offset_pair[++end1] = sibling_pair[i];
+            if (high == KeyTraits::maxKey)
+            {
+                pos = n;
+                return false;
+            }
+            pos = load(high, false);
         }
+        return true;
+    }
 
-        if (lazyflag2 == 1) //insert
+    bool SSBTree::Iterator::backward()
+    {
+        while (pos < 0)
         {
-            offset_pair[++end1].key = sibling->LazyBox.key;
-            offset_pair[end1].value = signextend(v);
+            if (low == KeyTraits::minKey)
+            {
+                pos = -1;
+                return false;
+            }
+            pos = load(low, true) - 1;
         }
-        else w++;
+        return true;
+    }
 
-        for (int i = w ; i <= end2; i++)
-        {
-            offset_pair[++end1] = sibling_pair[i];
-        }
+    bool SSBTree::Iterator::seek(const Key key)
+    {
+        pos = load(key, false);
+        return forward();
+    }
 
-        Node::clflush(pop, (char *)offset_pair + oldend + 1, (end1 - oldend)*sizeof(Pair), false, false);
+    bool SSBTree::Iterator::seekForPrev(const Key key)
+    {
+        pos = load(key, false);
+        if (pos < n && pairs[pos].key == key)
+            return true;
+        pos--;
+        return backward();
+    }
 
-        uint64_t newheader = header  + addNum_BITS * (end1 - oldend);
-        Node::addRight(newheader);
+    bool SSBTree::Iterator::next()
+    {
+        pos++;
+        return forward();
+    }
 
-        node->right[rightTurn(newheader)] = sibling->right[rightTurn(sibling_header)];
-        Node::clflush(pop, (char *)&node->right, cache_line_size, false, false);
+    bool SSBTree::Iterator::prev()
+    {
+        pos--;
+        return backward();
+    }
 
-        node->midkey[versionTurn(newheader)] = offset_pair[midindex].key;
-        node->maxKey[rightTurn(newheader)] = sibling->maxKey[rightTurn(sibling_header)];
-        node->header = newheader;
-        Node::clflush(pop, (char *)&node->header, cache_line_size, true, true);
 
-        epoche->markNodeForDeletion((void *)sibling, threadEpocheInfo);
-        sibling->header = (sibling_header | DEL_BITS);
-        //Node::clflush(pop,(char *)&sibling->header,sizeof(uint64_t),false,true);
-        pmemobj_mutex_unlock(pop, &node->mutex);
-        pmemobj_mutex_unlock(pop, &sibling->mutex);
+    /**************************************basic operators*******************************************************************/
+
+    uint64_t SSBTree::lookup(const Key findkey, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        TOID(Node) leafoid;
+        return search(findkey, leafoid, threadEpocheInfo);
     }
 
-    void SSBTree::leafscan(TOID(Node) nodeoid, const uint64_t minscan, const uint64_t maxscan, int length, uint64_t *results, int &offset)
+    //traversals advanced in lockstep by multiGet
+    static constexpr int multiGetGroup = 16;
+
+    //lookups of keys[0..n-1]; every step reads one node of a traversal and
+    //prefetches its next node before the next traversal takes a step
+    void SSBTree::multiGet(const Key *keys, size_t n, uint64_t *out, bool *found, ThreadInfo &threadEpocheInfo)
     {
-        while(nodeoid.oid.off != tailoid.oid.off)
+        struct Walk
         {
-            Node *node = D_RW(nodeoid);
-            int old_offset = offset;
+            size_t i;
+            TOID(Node) nodeoid;
+        } walks[multiGetGroup];
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        size_t next = 0;
+        int active = 0;
+        for (; active < multiGetGroup && next < n; active++)
+        {
+            walks[active] = Walk{next++, rootoid};
+            fromFinger(walks[active].nodeoid, keys[walks[active].i], false);
+            prefetch_node(D_RW(walks[active].nodeoid));
+        }
+        for (int w = 0; active > 0; w = w + 1 < active ? w + 1 : 0)
+        {
+            Walk &walk = walks[w];
+            const Key &findkey = keys[walk.i];
+            Node *node = D_RW(walk.nodeoid);
             uint64_t header = node->header;
-            int num = getNum(header) ;
-            int lazyflag = (header >> shiflazybox) & 0x3;
-
-            Pair lazybox = node->LazyBox;
-            num -= lazydiff[lazyflag];
-
-            Pair *offset_pair = &node->pairs[0];
-            if (versionTurn(header))
+            uint64_t result;
+            Key low;
+            bool present;
+            if (node->maxKey[rightTurn(header)] <= findkey)
             {
-                offset_pair = &node->pairs[maxPairsLength];
+                walk.nodeoid.oid.off = node->right[rightTurn(header)];
+                if (!Node::RightCheck(node->header, header))
+                    walk.nodeoid = rootoid;
+                prefetch_node(D_RW(walk.nodeoid));
+                continue;
             }
+            if (!readNode(node, header, findkey, false, result, low, present))
+            {
+                walk.nodeoid = rootoid;
+                continue;
+            }
+            if (!isBottom(header))
+            {
+                walk.nodeoid.oid.off = result;
+                prefetch_node(D_RW(walk.nodeoid));
+                continue;
+            }
+            out[walk.i] = result;
+            found[walk.i] = present;
+            if (next < n)
+            {
+                walk = Walk{next++, rootoid};
+                fromFinger(walk.nodeoid, keys[walk.i], false);
+                prefetch_node(D_RW(walk.nodeoid));
+            }
+            else
+            {
+                //the last traversal takes the slot; it was prefetched already
+                walk = walks[--active];
+                w--;
+            }
+        }
+    }
 
-            int w = -1;
-            uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-
-            if (lazyflag)
-                w = (v ^ signextend(v)) >> highPosition;
-
-            for (int i = 0 ; i < w; i++)
-                if (offset_pair[i].key >= minscan)
-                {
-                    if (offset_pair[i].key > maxscan) break;
-
-                    results[offset++] = reinterpret_cast<uint64_t>(offset_pair[i].value);
-
-                    if (offset == length) return;
-                }
-            if (lazyflag == 1 && lazybox.key >= minscan && lazybox.key <= maxscan)
+    //one read-only step of a traversal: result is the value of findkey at a bottom node, found whether it is present,
+    //and the child to descend to at an inner node, low the separator of that child;
+    //strict descends to the keys just below findkey. False if the node changed under the read
+    bool SSBTree::readNode(Node *node, uint64_t header, const Key &findkey, bool strict, uint64_t &result, Key &low, bool &found)
+    {
+        if (isCompact(header))
+        {
+            const uint8_t *slots = node->compact.slots[slotTurn(header)];
+            int k = compact_search(node, slots, getNum(header), findkey) - 1;
+            found = k >= 0 && compact_pair(node, slots, k).key == findkey;
+            result = found ? compact_pair(node, slots, k).value : 0;
+            return Node::ReadcheckVesion(header, node->header);
+        }
+        PairPtr offset_pair = node->half(versionTurn(header));
+        Key midkey = node->midkey[versionTurn(header)];
+        int lazyflag = (header >> shiflazybox) & 3;
+        Pair lazybox = node->LazyBox;
+        int oldend = getNum(header) - 1 - lazydiff[lazyflag] - getExtra(header);
+        int k = 0;
+#ifdef FINGERPRINT
+        //at a bottom node k is the position of findkey, or -1
+        if (isBottom(header))
+            k = fingerprint_search(node->fingerprints[versionTurn(header)], offset_pair, oldend, findkey) + 1;
+        else
+#endif
+        {
+            if (oldend >= midindex && midkey <= findkey)
             {
-                results[offset++] = signextend(v);
-                if (offset == length) return;
+                k = midindex + 1;
+                linear_search(k, offset_pair, oldend, findkey);
             }
-            if (lazyflag != 1) w++;
-            for (int i = w ; i < num; i++)
+            else linear_search(k, offset_pair, std::min(midindex, oldend), findkey);
+        }
+        k--;
+        if (isBottom(header))
+        {
+            int x = extra_search(node, header, findkey);
+            result = 0;
+            found = true;
+            if (lazyflag && lazybox.key == findkey)
             {
-                if (offset_pair[i].key >= minscan)
+                if (lazyflag == 1)
+                    result = lazybox.value;
+                else
+                    found = false;
+            }
+            else if (x >= 0)
+                result = *extra_value(node, x);
+            else if (k >= 0 && offset_pair[k].key == findkey)
+                result = offset_pair[k].value;
+            else
+                found = false;
+        }
+        else
+        {
+            //the first pair of an inner level holds minKey, so k >= 0
+            if (strict && k > 0 && offset_pair[k].key == findkey)
+                k--;
+            low = offset_pair[k].key;
+            result = offset_pair[k].value;
+            if (lazyflag == 0x2 && lazybox.key == low)
+            {
+                if (k > 0)
                 {
-                    if (offset_pair[i].key > maxscan) break;
-                    results[offset++] = reinterpret_cast<uint64_t>(offset_pair[i].value);
-                    if (offset == length) return;
+                    low = offset_pair[k - 1].key;
+                    result = offset_pair[k - 1].value;
                 }
+                else result = 0;
+            }
+            if (lazyflag == 1 && (lazybox.key < findkey || (!strict && lazybox.key == findkey)) && lazybox.key >= low)
+            {
+                low = lazybox.key;
+                result = lazybox.value;
             }
-            if (!Node::ReadcheckVesion(header, node->header))
-                offset = old_offset;
-            else nodeoid.oid.off = node->right[rightTurn(header)];
         }
+        return Node::ReadcheckVesion(header, node->header);
     }
 
-
-    /**************************************basic operators*******************************************************************/
-
-    uint64_t SSBTree::lookup(const uint64_t findkey, ThreadInfo &threadEpocheInfo)
+    //leafoid is set to the bottom node of findkey
+    uint64_t SSBTree::search(const Key findkey, TOID(Node) &leafoid, ThreadInfo &threadEpocheInfo)
     {
-
-        EpocheGuard epocheGuard(threadEpocheInfo);
 restart:
         TOID(Node) nodeoid = rootoid;
         TOID(Node) nextoid = headoid;
+        fromFinger(nodeoid, findkey, false);
         // Reading Process
         while(nodeoid.oid.off != tailoid.oid.off)
         {
@@ -677,13 +2190,27 @@ restart:
             //handle lazybox
 
 
-            Pair *offset_pair = &node->pairs[0];
-            Pair *move_pair = &node->pairs[maxPairsLength];
-            uint64_t midkey = node -> midkey[0];
+            if (isCompact(header))
+            {
+                const uint8_t *slots = node->compact.slots[slotTurn(header)];
+                int k = compact_search(node, slots, getNum(header), findkey) - 1;
+                uint64_t value = 0;
+                if (k >= 0 && compact_pair(node, slots, k).key == findkey)
+                    value = compact_pair(node, slots, k).value;
+                if (!Node::ReadcheckVesion(header, node->header))
+                    goto restart;
+                toFinger(nodeoid, header, findkey);
+                leafoid = nodeoid;
+                return value;
+            }
+
+            PairPtr offset_pair = node->half(0);
+            PairPtr move_pair = node->half(1);
+            Key midkey = node -> midkey[0];
 
             if (versionTurn(header))
             {
-                Pair *temp = offset_pair;
+                PairPtr temp = offset_pair;
                 offset_pair = move_pair;
                 move_pair = temp;
                 midkey = node -> midkey[1];
@@ -691,9 +2218,33 @@ restart:
 
             int lazyflag = (header >> shiflazybox) & 3;
             Pair lazybox = node->LazyBox;
-            int oldend = getNum(header) - 1 - lazydiff[lazyflag];
+            int oldend = getNum(header) - 1 - lazydiff[lazyflag] - getExtra(header);
             Pair upPair;
 
+#ifdef FINGERPRINT
+            //probe the fingerprints; a key pending in the LazyBox overrides the array
+            if (isBottom(header))
+            {
+                int pos = fingerprint_search(node->fingerprints[versionTurn(header)], offset_pair, oldend, findkey);
+                int x = extra_search(node, header, findkey);
+                uint64_t value = 0;
+                if (lazyflag && lazybox.key == findkey)
+                {
+                    if (lazyflag == 1)
+                        value = lazybox.value;
+                }
+                else if (x >= 0)
+                    value = *extra_value(node, x);
+                else if (pos >= 0)
+                    value = offset_pair[pos].value;
+                if (!Node::ReadcheckVesion(header, node->header))
+                    goto restart;
+                toFinger(nodeoid, header, findkey);
+                leafoid = nodeoid;
+                return value;
+            }
+#endif
+
 
             //line search
 
@@ -706,7 +2257,7 @@ restart:
             else linear_search(k, offset_pair, std::min(midindex, oldend), findkey);
             if (k == 0)
             {
-                upPair.key = 0;
+                upPair.key = KeyTraits::minKey;
                 nextoid.oid.off = upPair.value = 0;
             }
             else
@@ -719,11 +2270,11 @@ restart:
 
 
             //compare with lazybox
-            uint64_t succKey = node -> maxKey[rightTurn(header)];
+            Key succKey = node -> maxKey[rightTurn(header)];
 
             if (k < oldend )
             {
-                uint64_t nextKey =  offset_pair[k + 1].key;
+                Key nextKey =  offset_pair[k + 1].key;
                 if (lazyflag == 0x2  && lazybox.key == nextKey)
                 {
                     if (k + 1 < oldend)
@@ -739,7 +2290,7 @@ restart:
                 if (k > 0)  nextoid.oid.off = offset_pair[k - 1].value;
                 else
                 {
-                    upPair.key = 0;
+                    upPair.key = KeyTraits::minKey;
                     nextoid.oid.off = upPair.value = 0;
                 }
             }
@@ -748,8 +2299,7 @@ restart:
             {
                 if (lazybox.key <= findkey && lazybox.key >= upPair.key)
                 {
-                    uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-                    upPair.value = nextoid.oid.off = signextend(v);
+                    upPair.value = nextoid.oid.off = lazybox.value;
                     upPair.key = lazybox.key;
                 }
 
@@ -760,12 +2310,19 @@ restart:
 
 
 
+            int x = extra_search(node, header, findkey);
+            uint64_t xvalue = x >= 0 ? *extra_value(node, x) : 0;
+
             if (!Node::ReadcheckVesion(header, node->header))
                 goto restart;
 
             if (isBottom(header))
             {
-                if (upPair.key != findkey) return 0;
+                toFinger(nodeoid, header, findkey);
+                leafoid = nodeoid;
+                if (x >= 0) return xvalue;
+                //a key pending deletion in the LazyBox is still in the array
+                if (upPair.key != findkey || (lazyflag == 0x2 && lazybox.key == findkey)) return 0;
                 return reinterpret_cast<uint64_t> (upPair.value);
             }
 
@@ -780,12 +2337,12 @@ restart:
             Node *iterator = D_RW(nextoid);
             TOID(Node) temp = nextoid;
             uint32_t sum = 0;
-            uint64_t node_upper = node->maxKey[rightTurn(header)];
+            Key node_upper = node->maxKey[rightTurn(header)];
             //down
             uint64_t htd = iterator->header;
             temp.oid.off = iterator->right[rightTurn(htd)];
-            sum += getNum(htd) + getNum(D_RW(temp)->header);
-            if ( sum < Lnum && succKey != (uint64_t) - 1 && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper) )
+            sum += getLoad(htd) + getLoad(D_RW(temp)->header);
+            if ( sum < Lnum && succKey != KeyTraits::maxKey && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper) )
             {
                 if (succKey != node_upper && iterator->maxKey[rightTurn(htd)] == succKey)
                 {
@@ -808,7 +2365,7 @@ restart:
             while (iterator->maxKey[rightTurn(htd)] < findkey)
             {
                 iteratoroid.oid.off = iterator->right[rightTurn(htd)];
-                sum += getNum(iterator->header);
+                sum += getLoad(iterator->header);
                 upPair.key =  iterator->maxKey[rightTurn(htd)];
                 upPair.value =  iteratoroid.oid.off;
                 //if (iterator->maxKey[rightTurn(htd)]<findkey)
@@ -820,7 +2377,7 @@ restart:
                 htd = iterator->header;
 
             }
-            sum += getNum(htd);
+            sum += getLoad(htd);
             // No need to up
             if (sum <= Rnum )
             {
@@ -882,14 +2439,136 @@ WriteProcess:
         return 0;
     }
 
-    void SSBTree::put(const uint64_t insertKey, const uint64_t insertValue, ThreadInfo &threadEpocheInfo)
+    //node is still the rightmost bottom node, takes one more pair without a split, and key is past its last key
+    static inline bool appendable(Node *node, uint64_t header, uint64_t tailoff, const Key &key)
+    {
+        if (isObsolete(header) || !isBottom(header) || node->right[rightTurn(header)] != tailoff)
+            return false;
+        int num = getNum(header);
+        if (isCompact(header))
+            return num + 1 < (int)compactPairsLength && num > 0
+                   && compact_pair(node, node->compact.slots[slotTurn(header)], num - 1).key < key;
+        if (num + 1 >= (int)pairsLength(header) || getExtra(header))
+            return false;
+        int lazyflag = (header >> shiflazybox) & 3;
+        int end = num - 1 - lazydiff[lazyflag];
+        if (end < 0) return false;
+        Key last = node->half(versionTurn(header))[end].key;
+        if (lazyflag == 1 && node->LazyBox.key > last)
+            last = node->LazyBox.key;
+        return last < key;
+    }
+
+    //Ascending keys all land in the rightmost bottom node, so an insert past its last key goes there directly.
+    //A split still takes the full traversal, which also promotes the separators of the new nodes.
+    bool SSBTree::tryAppend(const Key insertKey, const uint64_t insertValue)
+    {
+        TOID(Node) nodeoid = headoid;
+        nodeoid.oid.off = rightmostLeaf.load(std::memory_order_acquire);
+        if (nodeoid.oid.off == 0) return false;
+        Node *node = D_RW(nodeoid);
+        //checked once without the lock, so other keys never take it
+        if (!appendable(node, node->header, tailoid.oid.off, insertKey))
+            return false;
+        pmemobj_mutex_lock(pop, &node->mutex);
+        uint64_t header = node->header;
+        if (!appendable(node, header, tailoid.oid.off, insertKey))
+        {
+            pmemobj_mutex_unlock(pop, &node->mutex);
+            return false;
+        }
+        Pair upPair = {insertKey, insertValue};
+        if (isCompact(header))
+            compactUpKey(node, header, upPair);
+        else
+        {
+            int lazyflag = (header >> shiflazybox) & 3;
+            Pair lazybox = node->LazyBox;
+            PairPtr offset_pair = node->half(versionTurn(header));
+            PairPtr move_pair = node->half(versionTurn(header) ^ 1);
+            int oldend = getNum(header) - 1 - lazydiff[lazyflag];
+            int k = oldend;
+            upKey(node, header, lazyflag, lazybox, upPair, move_pair, offset_pair, k, oldend);
+        }
+        header = node->header;
+        pmemobj_mutex_unlock(pop, &node->mutex);
+        if (getNum(header) + 4 >= (isCompact(header) ? compactPairsLength : pairsLength(header)))
+            reserveNode();
+        return true;
+    }
+
+#ifdef FINGER_CACHE
+    //Clustered keys of a thread keep landing in the same bottom node or the next one.
+    //key >= finger.low places the key at or right of the finger, so the walk to the right finds its node.
+    //An insert that may split the node takes the full traversal, which also promotes the new separator.
+    void SSBTree::fromFinger(TOID(Node) &nodeoid, const Key &key, bool insert)
     {
-        assert(insertKey != 0);
-        assert(insertKey != (uint64_t) - 1);
+        Finger &finger = fingers->local();
+        if (finger.leaf == 0 || key < finger.low) return;
+        TOID(Node) leafoid = headoid;
+        leafoid.oid.off = finger.leaf;
+        Node *leaf = D_RW(leafoid);
+        uint64_t header = leaf->header;
+        //a node is obsolete before it is freed: a live header read before an unchanged freed count
+        //means the node cannot be freed until this epoch ends
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (isObsolete(header) || !isBottom(header) || epoche->freedNodes.load(std::memory_order_acquire) != finger.freed)
+            return;
+        if (insert)
+        {
+            uint64_t capacity = isCompact(header) ? compactPairsLength : pairsLength(header);
+            if (getNum(header) + 1 >= capacity || leaf->maxKey[rightTurn(header)] <= key)
+                return;
+        }
+        else if (leaf->maxKey[rightTurn(header)] <= key)
+        {
+            //one node to the right at most
+            TOID(Node) nextoid = headoid;
+            nextoid.oid.off = leaf->right[rightTurn(header)];
+            if (nextoid.oid.off == tailoid.oid.off || D_RW(nextoid)->maxKey[rightTurn(D_RW(nextoid)->header)] <= key)
+                return;
+        }
+        nodeoid = leafoid;
+    }
+
+    //header was read from the node during this operation
+    void SSBTree::toFinger(TOID(Node) nodeoid, uint64_t header, const Key &key)
+    {
+#ifdef STRING_KEY
+        if (key.isTransient()) return; //the finger outlives the caller's bytes
+#endif
+        if (isObsolete(header)) return;
+        Finger &finger = fingers->local();
+        uint64_t freed = epoche->freedNodes.load(std::memory_order_acquire);
+        if (finger.leaf != nodeoid.oid.off || finger.freed != freed || key < finger.low)
+            finger.low = key;
+        finger.leaf = nodeoid.oid.off;
+        finger.freed = freed;
+    }
+#else
+    inline void SSBTree::fromFinger(TOID(Node) &, const Key &, bool) {}
+    inline void SSBTree::toFinger(TOID(Node), uint64_t, const Key &) {}
+#endif
+
+    void SSBTree::put(const Key insertKey, const uint64_t insertValue, ThreadInfo &threadEpocheInfo)
+    {
+        assert(insertKey != KeyTraits::minKey);
+        assert(insertKey != KeyTraits::maxKey);
+#ifdef STRING_KEY
+        if (insertKey.isTransient())
+            return put(storeKey(insertKey), insertValue, threadEpocheInfo);
+#endif
         EpocheGuard epocheGuard(threadEpocheInfo);
+        uint64_t since = countSince();
+        if (tryAppend(insertKey, insertValue))
+        {
+            countKey(insertKey, 1, since);
+            return;
+        }
 restart:
         TOID(Node) nodeoid = headoid;
         TOID(Node) nextoid = headoid;
+        fromFinger(nodeoid, insertKey, true);
         // Reading Process
         while(nodeoid.oid.off != tailoid.oid.off)
         {
@@ -906,21 +2585,45 @@ restart:
 
 
 
-            Pair *offset_pair = &node->pairs[0];
-            Pair *move_pair = &node->pairs[maxPairsLength];
-            uint64_t midkey = node -> midkey[0];
+            if (isCompact(header))
+            {
+                pmemobj_mutex_lock(pop, &node->mutex);
+                if (!Node::WritecheckVesion(header, node->header) || isObsolete(header))
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                header = node->header;
+                if (node->maxKey[rightTurn(header)] <= insertKey)
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                if (node->right[rightTurn(header)] == tailoid.oid.off)
+                    rightmostLeaf.store(nodeoid.oid.off, std::memory_order_release);
+                toFinger(nodeoid, header, insertKey);
+                Pair upPair = {insertKey, insertValue};
+                compactUpKey(node, header, upPair);
+                pmemobj_mutex_unlock(pop, &node->mutex);
+                countKey(insertKey, 1, since);
+                return;
+            }
+
+            PairPtr offset_pair = node->half(0);
+            PairPtr move_pair = node->half(1);
+            Key midkey = node -> midkey[0];
             if (versionTurn(header))
             {
-                Pair *temp = offset_pair;
+                PairPtr temp = offset_pair;
                 offset_pair = move_pair;
                 move_pair = temp;
                 midkey = node -> midkey[1];
             }
 
-            uint64_t succKey = node -> maxKey[rightTurn(header)];
+            Key succKey = node -> maxKey[rightTurn(header)];
             int lazyflag = (header >> shiflazybox) & 3;
             Pair lazybox = node->LazyBox;
-            int oldend = getNum(header) - 1 - lazydiff[lazyflag];
+            int oldend = getNum(header) - 1 - lazydiff[lazyflag] - getExtra(header);
             Pair upPair;
 
             int k = 0;
@@ -930,7 +2633,7 @@ restart:
 
             if (k == 0)
             {
-                upPair.key = 0;
+                upPair.key = KeyTraits::minKey;
                 nextoid.oid.off = upPair.value = 0;
             }
             else
@@ -943,7 +2646,7 @@ restart:
             //compare with lazybox
             if (k < oldend )
             {
-                uint64_t nextKey =  offset_pair[k + 1].key;
+                Key nextKey =  offset_pair[k + 1].key;
                 if (lazyflag == 0x2  && lazybox.key == nextKey)
                 {
                     if (k + 1 < oldend)
@@ -958,7 +2661,7 @@ restart:
                 if (k > 0)  nextoid.oid.off = offset_pair[k - 1].value;
                 else
                 {
-                    upPair.key = 0;
+                    upPair.key = KeyTraits::minKey;
                     nextoid.oid.off = upPair.value = insertValue;
                 }
             }
@@ -967,8 +2670,7 @@ restart:
             {
                 if (lazybox.key <= insertKey && lazybox.key >= upPair.key)
                 {
-                    uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-                    nextoid.oid.off = signextend(v);
+                    nextoid.oid.off = lazybox.value;
                 }
                 if (lazybox.key > insertKey && lazybox.key <= succKey)
                     succKey = lazybox.key;
@@ -985,7 +2687,7 @@ restart:
             TOID(Node) temp = nextoid;
             TOID(Node) iteratoroid = nextoid;
             uint32_t sum = 0;
-            uint64_t node_upper = node->maxKey[rightTurn(header)];
+            Key node_upper = node->maxKey[rightTurn(header)];
             uint64_t htd = 0;
             if (isBottom(header) )
             {
@@ -1001,8 +2703,8 @@ restart:
             //down
             htd = iterator->header;
             temp.oid.off = iterator->right[rightTurn(htd)];
-            sum += getNum(htd) + getNum(D_RW(temp)->header);
-            if ( sum < Lnum && succKey != (uint64_t) - 1 && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper) )
+            sum += getLoad(htd) + getLoad(D_RW(temp)->header);
+            if ( sum < Lnum && succKey != KeyTraits::maxKey && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper) )
             {
                 if (succKey != node_upper && iterator->maxKey[rightTurn(htd)] == succKey)
                 {
@@ -1026,7 +2728,7 @@ restart:
             while (iterator->maxKey[rightTurn(htd)] < insertKey)
             {
                 iteratoroid.oid.off = iterator->right[rightTurn(htd)];
-                sum += getNum(iterator->header);
+                sum += getLoad(iterator->header);
                 upPair.key =  iterator->maxKey[rightTurn(htd)];
                 upPair.value =  iteratoroid.oid.off;
                 //if (iterator->maxKey[rightTurn(htd)]<insertKey)
@@ -1037,7 +2739,7 @@ restart:
                 iterator = D_RW(iteratoroid);
                 htd = iterator->header;
             }
-            sum += getNum(htd);
+            sum += getLoad(htd);
             // No need to up
             if (sum <= Rnum )
             {
@@ -1082,6 +2784,10 @@ WriteProcess:
                 pmemobj_mutex_unlock(pop, &node->mutex);
                 goto restart;
             }
+            if (isBottom(header) && node->right[rightTurn(header)] == tailoid.oid.off)
+                rightmostLeaf.store(nodeoid.oid.off, std::memory_order_release);
+            if (isBottom(header))
+                toFinger(nodeoid, header, insertKey);
 
             if (op)
             {
@@ -1095,18 +2801,31 @@ WriteProcess:
                 pmemobj_mutex_unlock(pop, &node->mutex);
                 merge(D_RW(nextoid), threadEpocheInfo);
             }
-            if (isBottom(header)) return;
+            if (isBottom(header))
+            {
+                countKey(insertKey, 1, since);
+                return;
+            }
             nodeoid = nextoid;
         }
     }
 
-    void SSBTree::update(const uint64_t updatekey, const uint64_t updatevalue, ThreadInfo &threadEpocheInfo)
+    uint64_t SSBTree::update(const Key updatekey, const uint64_t updatevalue, ThreadInfo &threadEpocheInfo)
+    {
+        uint64_t old = 0;
+        update(updatekey, updatevalue, old, threadEpocheInfo);
+        return old;
+    }
+
+    //sets old to the replaced value; false if the key is absent, which a 0 value cannot tell
+    bool SSBTree::update(const Key updatekey, const uint64_t updatevalue, uint64_t &old, ThreadInfo &threadEpocheInfo)
     {
 
         EpocheGuard epocheGuard(threadEpocheInfo);
 restart:
         TOID(Node) nodeoid = rootoid;
         TOID(Node) nextoid = headoid;
+        fromFinger(nodeoid, updatekey, false);
         // Reading Process
         while(nodeoid.oid.off != tailoid.oid.off)
         {
@@ -1121,24 +2840,78 @@ restart:
                 header = node->header;
             }
 
-            Pair *offset_pair = &node->pairs[0];
-            Pair *move_pair = &node->pairs[maxPairsLength];
-            uint64_t midkey = node -> midkey[0];
-            Oidoff *needupdate = &node->pairs[0].value;
+            if (isCompact(header))
+            {
+                const uint8_t *slots = node->compact.slots[slotTurn(header)];
+                int k = compact_search(node, slots, getNum(header), updatekey) - 1;
+                Pair *needupdate = k >= 0 ? &compact_pair(node, slots, k) : nullptr;
+                if (!Node::ReadcheckVesion(header, node->header))
+                    goto restart;
+                toFinger(nodeoid, header, updatekey);
+                if (needupdate == nullptr || needupdate->key != updatekey) return false;
+                pmemobj_mutex_lock(pop, &node->mutex);
+                //a split shrinks num without a new version
+                if (!Node::WritecheckVesion(header, node->header) || isObsolete(header))
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                old = needupdate->value;
+                needupdate->value = updatevalue;
+                Node::clflush(pop, (char *)&needupdate->value, sizeof(Oidoff), false, true);
+                count_update(node);
+                pmemobj_mutex_unlock(pop, &node->mutex);
+                return true;
+            }
+
+            PairPtr offset_pair = node->half(0);
+            PairPtr move_pair = node->half(1);
+            Key midkey = node -> midkey[0];
             if (versionTurn(header))
             {
-                Pair *temp = offset_pair;
+                PairPtr temp = offset_pair;
                 offset_pair = move_pair;
                 move_pair = temp;
                 midkey = node -> midkey[1];
-                needupdate = &node->pairs[maxPairsLength].value;
             }
+            Oidoff *needupdate = &offset_pair[0].value;
 
             int lazyflag = (header >> shiflazybox) & 3;
             Pair lazybox = node->LazyBox;
-            int oldend = getNum(header) - 1 - lazydiff[lazyflag];
+            int oldend = getNum(header) - 1 - lazydiff[lazyflag] - getExtra(header);
             Pair upPair;
 
+#ifdef FINGERPRINT
+            if (isBottom(header))
+            {
+                int pos = fingerprint_search(node->fingerprints[versionTurn(header)], offset_pair, oldend, updatekey);
+                int x = extra_search(node, header, updatekey);
+                bool inbox = lazyflag && lazybox.key == updatekey;
+                if (!Node::ReadcheckVesion(header, node->header))
+                    goto restart;
+                toFinger(nodeoid, header, updatekey);
+                if (inbox ? lazyflag == 2 : pos < 0 && x < 0) return false;
+                pmemobj_mutex_lock(pop, &node->mutex);
+                //a copy-on-write moves the pair to the other half
+                if (!Node::WritecheckVesion(header, node->header) || isObsolete(header))
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                if (x >= 0 && !inbox)
+                    needupdate = extra_value(node, x);
+                else if (inbox)
+                    needupdate = &node->LazyBox.value;
+                else
+                    needupdate = &offset_pair[pos].value;
+                old = *needupdate;
+                *needupdate = updatevalue;
+                count_update(node);
+                pmemobj_mutex_unlock(pop, &node->mutex);
+                return true;
+            }
+#endif
+
             //line search
             int k = 0;
             if (oldend >= midindex && midkey <= updatekey)
@@ -1150,13 +2923,18 @@ restart:
                 nextoid.oid.off = upPair.value = offset_pair[k - 1].value;
                 needupdate =  &offset_pair[k - 1].value;
             }
+            else
+            {
+                upPair.key = KeyTraits::minKey;
+                nextoid.oid.off = upPair.value = 0;
+            }
             k--;
             //compare with lazybox
-            uint64_t succKey = node -> maxKey[rightTurn(header)];
+            Key succKey = node -> maxKey[rightTurn(header)];
 
             if (k < oldend )
             {
-                uint64_t nextKey =  offset_pair[k + 1].key;
+                Key nextKey =  offset_pair[k + 1].key;
                 if (lazyflag == 0x2  && lazybox.key == nextKey)
                 {
                     if (k + 1 < oldend)
@@ -1171,7 +2949,7 @@ restart:
                 if (k > 0)  nextoid.oid.off = offset_pair[k - 1].value;
                 else
                 {
-                    upPair.key = 0;
+                    upPair.key = KeyTraits::minKey;
                     nextoid.oid.off = upPair.value = 0;
                     needupdate =  0;
                 }
@@ -1181,8 +2959,7 @@ restart:
             {
                 if (lazybox.key <= updatekey && lazybox.key >= upPair.key)
                 {
-                    uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-                    upPair.value = nextoid.oid.off = signextend(v);
+                    upPair.value = nextoid.oid.off = lazybox.value;
                     upPair.key = lazybox.key;
                     needupdate = &node->LazyBox.value;
                 }
@@ -1190,33 +2967,33 @@ restart:
                     succKey = lazybox.key;
             }
 
+            int x = extra_search(node, header, updatekey);
+            if (x >= 0)
+            {
+                upPair.key = updatekey;
+                needupdate = extra_value(node, x);
+            }
 
             if (!Node::ReadcheckVesion(header, node->header))
                 goto restart;
 
             if (isBottom(header) )
             {
-                if (upPair.key != updatekey) return;
+                toFinger(nodeoid, header, updatekey);
+                if (upPair.key != updatekey || (lazyflag == 0x2 && lazybox.key == updatekey)) return false;
                 pmemobj_mutex_lock(pop, &node->mutex);
-                //checkversion
-                if (!Node::ReadcheckVesion(header, node->header) || isObsolete(header))
+                //checkversion; a copy-on-write moves the pair to the other half
+                if (!Node::WritecheckVesion(header, node->header) || isObsolete(header))
                 {
                     pmemobj_mutex_unlock(pop, &node->mutex);
                     goto restart;
                 }
 
-                if (upPair.key == lazybox.key && lazyflag)
-                {
-                    uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-                    uint32_t w = (v ^ signextend(v)) >> highPosition;
-                    *needupdate = updatevalue ^ ((uint64_t)w << highPosition);
-                }
-                else
-                {
-                    *needupdate = updatevalue;
-                }
+                old = *needupdate;
+                *needupdate = updatevalue;
+                count_update(node);
                 pmemobj_mutex_unlock(pop, &node->mutex);
-                return ;
+                return true;
             }
 
             bool op = true;//up;
@@ -1229,11 +3006,11 @@ restart:
             TOID(Node) iteratoroid = nextoid;
             Node *iterator = D_RW(nextoid);
             uint32_t sum = 0;
-            uint64_t node_upper = node->maxKey[rightTurn(header)];
+            Key node_upper = node->maxKey[rightTurn(header)];
             uint64_t htd = iterator->header;
             temp.oid.off = iterator->right[rightTurn(htd)];
-            sum += getNum(htd) + getNum(D_RW(temp)->header);
-            if ( sum < Lnum && succKey != (uint64_t) - 1 && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper) )
+            sum += getLoad(htd) + getLoad(D_RW(temp)->header);
+            if ( sum < Lnum && succKey != KeyTraits::maxKey && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper) )
             {
                 if (succKey != node_upper && iterator->maxKey[rightTurn(htd)] == succKey)
                 {
@@ -1257,7 +3034,7 @@ restart:
             while (iterator->maxKey[rightTurn(htd)] < updatekey)
             {
                 iteratoroid.oid.off = iterator->right[rightTurn(htd)];
-                sum += getNum(iterator->header);
+                sum += getLoad(iterator->header);
                 upPair.key =  iterator->maxKey[rightTurn(htd)];
                 upPair.value =  iteratoroid.oid.off;
                 //if (iterator->maxKey[rightTurn(htd)]<updatekey)
@@ -1267,7 +3044,7 @@ restart:
                 iterator = D_RW(iteratoroid);
                 htd = iterator->header;
             }
-            sum += getNum(htd);
+            sum += getLoad(htd);
             // No need to up
             if (sum <= Rnum )
             {
@@ -1324,12 +3101,21 @@ WriteProcess:
             }
             nodeoid = nextoid;
         }
+        return false;
     }
 
-    void SSBTree::normalRemove(const uint64_t removekey, ThreadInfo &threadEpocheInfo)
+    uint64_t SSBTree::normalRemove(const Key removekey, ThreadInfo &threadEpocheInfo)
     {
-        assert(removekey != 0);
-        assert(removekey != (uint64_t) - 1);
+        uint64_t old = 0;
+        normalRemove(removekey, old, threadEpocheInfo);
+        return old;
+    }
+
+    //sets old to the removed value; false if the key is absent, which a 0 value cannot tell
+    bool SSBTree::normalRemove(const Key removekey, uint64_t &old, ThreadInfo &threadEpocheInfo)
+    {
+        assert(removekey != KeyTraits::minKey);
+        assert(removekey != KeyTraits::maxKey);
         EpocheGuard epocheGuard(threadEpocheInfo);
 restart:
         TOID(Node) nodeoid =  headoid;
@@ -1348,13 +3134,32 @@ restart:
                 header = node->header;
             }
             //if (debug==35) return;
-            Pair *offset_pair = &node->pairs[0];
-            Pair *move_pair = &node->pairs[maxPairsLength];
-            uint64_t midkey = node -> midkey[0];
+            if (isCompact(header))
+            {
+                pmemobj_mutex_lock(pop, &node->mutex);
+                if (!Node::WritecheckVesion(header, node->header) || isObsolete(header))
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                header = node->header;
+                if (node->maxKey[rightTurn(header)] <= removekey)
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                bool removed = compactDownKey(node, header, removekey, old);
+                pmemobj_mutex_unlock(pop, &node->mutex);
+                return removed;
+            }
+
+            PairPtr offset_pair = node->half(0);
+            PairPtr move_pair = node->half(1);
+            Key midkey = node -> midkey[0];
 
             if (versionTurn(header))
             {
-                Pair *temp = offset_pair;
+                PairPtr temp = offset_pair;
                 offset_pair = move_pair;
                 move_pair = temp;
                 midkey = node -> midkey[1];
@@ -1362,9 +3167,35 @@ restart:
 
             int lazyflag = (header >> shiflazybox) & 3;
             Pair lazybox = node->LazyBox;
-            int oldend = getNum(header) - 1 - lazydiff[lazyflag];
+            int oldend = getNum(header) - 1 - lazydiff[lazyflag] - getExtra(header);
             Pair downPair;
 
+#ifdef FINGERPRINT
+            if (isBottom(header))
+            {
+                int pos = fingerprint_search(node->fingerprints[versionTurn(header)], offset_pair, oldend, removekey);
+                int x = extra_search(node, header, removekey);
+                if (!Node::ReadcheckVesion(header, node->header))
+                    goto restart;
+                if (pos < 0 && x < 0 && (lazyflag != 1 || removekey != lazybox.key)) return false;
+                //take the stored copy of the key, removekey may only wrap the caller's bytes
+                //(a pending extra box is merged away and never stores it)
+                downPair.key = pos >= 0 ? offset_pair[pos].key : x >= 0 ? removekey : lazybox.key;
+
+                pmemobj_mutex_lock(pop, &node->mutex);
+                if (!Node::WritecheckVesion(header, node->header) || isObsolete(header))
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                header = node->header;
+                downKey(node, header, lazyflag, lazybox, downPair, move_pair, offset_pair, pos, oldend, threadEpocheInfo);
+                pmemobj_mutex_unlock(pop, &node->mutex);
+                old = downPair.value;
+                return true;
+            }
+#endif
+
             //line search
             int k = 0;
             if (oldend >= midindex && midkey <= removekey)
@@ -1372,7 +3203,7 @@ restart:
             linear_search(k, offset_pair, oldend, removekey);
             if (k == 0)
             {
-                downPair.key = 0;
+                downPair.key = KeyTraits::minKey;
                 nextoid.oid.off = downPair.value = 0;
             }
             else
@@ -1388,7 +3219,7 @@ restart:
                 if (k > 0)  nextoid.oid.off = offset_pair[k - 1].value;
                 else
                 {
-                    downPair.key = 0;
+                    downPair.key = KeyTraits::minKey;
                     nextoid.oid.off = downPair.value = 0;
                 }
             }
@@ -1398,10 +3229,11 @@ restart:
 
                 if (lazybox.key <= removekey && lazybox.key > downPair.key)
                 {
-                    uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-                    nextoid.oid.off  = signextend(v);
+                    nextoid.oid.off  = lazybox.value;
                 }
             }
+            if (extra_search(node, header, removekey) >= 0)
+                downPair.key = removekey;
 
             if (!Node::ReadcheckVesion(header, node->header))
                 goto restart;
@@ -1412,8 +3244,8 @@ restart:
                 continue;
             }
             //4.Writing Process
-            if (downPair.key != removekey && (!lazyflag || removekey != lazybox.key)) return;
-            downPair.key = removekey;
+            if (downPair.key != removekey && (!lazyflag || removekey != lazybox.key)) return false;
+            if (downPair.key != removekey) downPair.key = lazybox.key;
 
             pmemobj_mutex_lock(pop, &node->mutex);
 
@@ -1426,14 +3258,24 @@ restart:
             header = node->header;
             downKey(node, header, lazyflag, lazybox, downPair, move_pair, offset_pair, k, oldend, threadEpocheInfo);
             pmemobj_mutex_unlock(pop, &node->mutex);
-            return;
+            old = downPair.value;
+            return true;
         }
+        return false;
+    }
+
+    uint64_t SSBTree::balanceRemove(const Key removekey, ThreadInfo &threadEpocheInfo)
+    {
+        uint64_t old = 0;
+        balanceRemove(removekey, old, threadEpocheInfo);
+        return old;
     }
 
-    void SSBTree::balanceRemove(const uint64_t removekey, ThreadInfo &threadEpocheInfo)
+    //sets old to the removed value; false if the key is absent, which a 0 value cannot tell
+    bool SSBTree::balanceRemove(const Key removekey, uint64_t &old, ThreadInfo &threadEpocheInfo)
     {
-        assert(removekey != 0);
-        assert(removekey != (uint64_t) - 1);
+        assert(removekey != KeyTraits::minKey);
+        assert(removekey != KeyTraits::maxKey);
         EpocheGuard epocheGuard(threadEpocheInfo);
 restart:
         TOID(Node) nodeoid = headoid;
@@ -1454,14 +3296,33 @@ restart:
             }
 
             uint64_t header = node -> header;
-            uint64_t succKey = node -> maxKey[rightTurn(header)];
+            if (isCompact(header))
+            {
+                pmemobj_mutex_lock(pop, &node->mutex);
+                if (!Node::WritecheckVesion(header, node->header) || isObsolete(header))
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                header = node->header;
+                if (node->maxKey[rightTurn(header)] <= removekey)
+                {
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    goto restart;
+                }
+                bool removed = compactDownKey(node, header, removekey, old);
+                pmemobj_mutex_unlock(pop, &node->mutex);
+                return removed;
+            }
 
-            Pair *offset_pair = &node->pairs[0];
-            Pair *move_pair = &node->pairs[maxPairsLength];
-            uint64_t midkey = node -> midkey[0];
+            Key succKey = node -> maxKey[rightTurn(header)];
+
+            PairPtr offset_pair = node->half(0);
+            PairPtr move_pair = node->half(1);
+            Key midkey = node -> midkey[0];
             if (versionTurn(header))
             {
-                Pair *temp = offset_pair;
+                PairPtr temp = offset_pair;
                 offset_pair = move_pair;
                 move_pair = temp;
                 midkey = node -> midkey[1];
@@ -1470,7 +3331,7 @@ restart:
 
             int lazyflag = (header >> shiflazybox) & 3;
             Pair lazybox = node->LazyBox;
-            int oldend = getNum(header) - 1 - lazydiff[lazyflag];
+            int oldend = getNum(header) - 1 - lazydiff[lazyflag] - getExtra(header);
             Pair downPair;
 
             //line search
@@ -1482,7 +3343,7 @@ restart:
 
             if (k == 0)
             {
-                downPair.key = 0;
+                downPair.key = KeyTraits::minKey;
                 nextoid.oid.off = downPair.value = 0;
             }
             else
@@ -1494,11 +3355,9 @@ restart:
             k--;
 
             //compare with lazybox
-            uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-
             if (k < oldend )
             {
-                uint64_t nextKey =  offset_pair[k + 1].key;
+                Key nextKey =  offset_pair[k + 1].key;
                 if (lazyflag == 0x2  && lazybox.key == nextKey)
                 {
                     if (k + 1 < oldend)
@@ -1512,7 +3371,7 @@ restart:
                 if (k > 0)  nextoid.oid.off = offset_pair[k - 1].value;
                 else
                 {
-                    downPair.key = 0;
+                    downPair.key = KeyTraits::minKey;
                     nextoid.oid.off = downPair.value = 0;
                 }
             }
@@ -1521,17 +3380,19 @@ restart:
             {
 
                 if (lazybox.key <= removekey && lazybox.key > downPair.key)
-                    nextoid.oid.off = signextend(v);
+                    nextoid.oid.off = lazybox.value;
 
                 if (lazybox.key > removekey && lazybox.key <= succKey)
                     succKey = lazybox.key;
 
             }
+            if (extra_search(node, header, removekey) >= 0)
+                downPair.key = removekey;
             TOID(Node) iteratoroid = nextoid;
             Node *iterator = D_RW(iteratoroid);
             TOID(Node) temp = nextoid;
             uint32_t sum = 0;
-            uint64_t node_upper = node->maxKey[rightTurn(header)];
+            Key node_upper = node->maxKey[rightTurn(header)];
             bool op = false;//down;
             bool needdown = false;
             if (!Node::ReadcheckVesion(header, node->header))
@@ -1539,8 +3400,8 @@ restart:
 
             if (isBottom(header) )
             {
-                if (downPair.key != removekey && (!lazyflag || removekey != lazybox.key)) return;
-                downPair.key = removekey;
+                if (downPair.key != removekey && (!lazyflag || removekey != lazybox.key)) return false;
+                if (downPair.key != removekey) downPair.key = lazybox.key;
                 needdown = true;
                 goto WriteProcess;
             }
@@ -1549,8 +3410,8 @@ restart:
             //down
             htd = iterator->header;
             temp.oid.off = iterator->right[rightTurn(htd)];
-            sum += getNum(htd) + getNum(D_RW(temp)->header);
-            if ( sum < Lnum && succKey != (uint64_t) - 1 && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper))
+            sum += getLoad(htd) + getLoad(D_RW(temp)->header);
+            if ( sum < Lnum && succKey != KeyTraits::maxKey && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper))
             {
                 if (succKey != node_upper && iterator->maxKey[rightTurn(htd)] == succKey)
                 {
@@ -1572,7 +3433,7 @@ restart:
             while (iterator->maxKey[rightTurn(htd)] < removekey)
             {
                 iteratoroid.oid.off = iterator->right[rightTurn(htd)];
-                sum += getNum(iterator->header);
+                sum += getLoad(iterator->header);
                 downPair.key =  iterator->maxKey[rightTurn(htd)];
                 downPair.value =  iteratoroid.oid.off;
                 //if (iterator->maxKey[rightTurn(htd)]<removekey)
@@ -1582,7 +3443,7 @@ restart:
                 iterator = D_RW(iteratoroid);
                 htd = iterator->header;
             }
-            sum += getNum(htd);
+            sum += getLoad(htd);
             // No need to up
 
             if (sum <= Rnum )
@@ -1627,21 +3488,185 @@ WriteProcess:
                 if (!isBottom(header))
                     merge(D_RW(nextoid), threadEpocheInfo);
             }
-            if (isBottom(header)) return;
+            if (isBottom(header))
+            {
+                old = downPair.value;
+                return true;
+            }
             nodeoid = nextoid;
         }
+        return false;
     }
 
-    void SSBTree::remove(const uint64_t removekey, ThreadInfo &threadEpocheInfo)
+    uint64_t SSBTree::remove(const Key removekey, ThreadInfo &threadEpocheInfo)
     {
+        uint64_t since = countSince();
+        uint64_t old = 0;
 #ifdef REBALANCE
-        balanceRemove(removekey, threadEpocheInfo);
+        bool removed = balanceRemove(removekey, old, threadEpocheInfo);
+#else
+        bool removed = normalRemove(removekey, old, threadEpocheInfo);
+#endif
+        if (removed)
+            countKey(removekey, -1, since);
+        return old;
+    }
+
+    //Returns how many leading ops were applied to the bottom node of ops[0].key, all with one copy-on-write.
+    //0 means ops[0] is left to the single-key path: the node is compact or the insert needs a split.
+    size_t SSBTree::applyLeaf(const Op *ops, size_t n, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        uint64_t since = countSince();
+        TOID(Node) leafoid;
+        Node *node;
+        uint64_t header;
+        while (true)
+        {
+            search(ops[0].key, leafoid, threadEpocheInfo);
+            node = D_RW(leafoid);
+            pmemobj_mutex_lock(pop, &node->mutex);
+            header = node->header;
+            if (!isObsolete(header) && ops[0].key < node->maxKey[rightTurn(header)])
+                break;
+            pmemobj_mutex_unlock(pop, &node->mutex);
+        }
+        if (isCompact(header))
+        {
+            pmemobj_mutex_unlock(pop, &node->mutex);
+            return 0;
+        }
+
+        Key maxKey = node->maxKey[rightTurn(header)];
+        Pair cur[maxPairsLength];
+        int ncur = node_pairs(node, header, cur);
+        //with an empty lazybox, ReadcheckVesion still accepts readers of the previous version, which read the other half.
+        //Skip a version pair, keeping the turn, before that half is overwritten
+        if (((header >> shiflazybox) & 3) == 0)
+        {
+            header += 2 * addVersion_BITS;
+            node->header = header;
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        PairPtr move_pair = node->half(versionTurn(header) ^ 1);
+        int m = 0, c = 0, delta = 0;
+        bool changed = false;
+        size_t j = 0;
+        for (; j < n && ops[j].key < maxKey; j++)
+        {
+            const Op &op = ops[j];
+            while (c < ncur && cur[c].key < op.key)
+                move_pair[m++] = cur[c++];
+            if (m > 0 && move_pair[m - 1].key == op.key)
+            {
+                //an earlier op of the batch wrote this key
+                if (op.remove)
+                {
+                    m--;
+                    delta--;
+                }
+                else
+                    move_pair[m - 1].value = op.value;
+            }
+            else if (c < ncur && cur[c].key == op.key)
+            {
+                if (!op.remove)
+                    move_pair[m++] = Pair{cur[c].key, op.value};
+                else
+                    delta--;
+                c++;
+            }
+            else if (!op.remove)
+            {
+                if (m + (ncur - c) + 1 >= (int)pairsLength(header))
+                    break;
+#ifdef STRING_KEY
+                move_pair[m++] = Pair{op.key.isTransient() ? storeKey(op.key) : op.key, op.value};
 #else
-        normalRemove(removekey, threadEpocheInfo);
+                move_pair[m++] = Pair{op.key, op.value};
 #endif
+                delta++;
+            }
+            else
+                continue;
+            changed = true;
+        }
+        if (changed)
+        {
+            while (c < ncur)
+                move_pair[m++] = cur[c++];
+            switch_half(pop, node, header, m);
+        }
+        pmemobj_mutex_unlock(pop, &node->mutex);
+        //the ops share the path of the node
+        if (delta)
+            countKey(ops[0].key, delta, since);
+        return j;
+    }
+
+    void SSBTree::applyBatch(const Op *ops, size_t n, ThreadInfo &threadEpocheInfo)
+    {
+        for (size_t i = 0; i < n;)
+        {
+            size_t done = applyLeaf(ops + i, n - i, threadEpocheInfo);
+            if (done == 0)
+            {
+                const Op &op = ops[i];
+                if (op.remove)
+                    remove(op.key, threadEpocheInfo);
+                else
+                {
+                    uint64_t old;
+                    if (!update(op.key, op.value, old, threadEpocheInfo))
+                        put(op.key, op.value, threadEpocheInfo);
+                }
+                done = 1;
+            }
+            i += done;
+        }
+    }
+
+    void SSBTree::put(const Key insertKey, const ValueView &value, ThreadInfo &threadEpocheInfo)
+    {
+        put(insertKey, valueLog->append(value), threadEpocheInfo);
+    }
+
+    //the replaced record is reclaimed once no reader can still hold its offset
+    bool SSBTree::update(const Key updatekey, const ValueView &value, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        uint64_t ref = valueLog->append(value);
+        uint64_t old;
+        if (!update(updatekey, ref, old, threadEpocheInfo))
+        {
+            valueLog->release(valueLog->record(ref));
+            return false;
+        }
+        epoche->markRecordForDeletion(valueLog->record(old), threadEpocheInfo);
+        return true;
     }
 
-    void SSBTree::scan(const uint64_t minscan, const uint64_t maxscan, int length, uint64_t *results, int &offset, ThreadInfo &threadEpocheInfo)
+    bool SSBTree::lookup(const Key findkey, std::string &value, ThreadInfo &threadEpocheInfo)
+    {
+        //the guard keeps the record alive while it is copied
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        uint64_t ref = lookup(findkey, threadEpocheInfo);
+        if (ref == 0) return false;
+        ValueView v = valueLog->view(ref);
+        value.assign(v.data, v.len);
+        return true;
+    }
+
+    bool SSBTree::removeValue(const Key removekey, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        uint64_t old = remove(removekey, threadEpocheInfo);
+        if (old == 0) return false;
+        epoche->markRecordForDeletion(valueLog->record(old), threadEpocheInfo);
+        return true;
+    }
+
+    void SSBTree::scan(const Key minscan, const Key maxscan, int length, uint64_t *results, int &offset, ThreadInfo &threadEpocheInfo)
     {
         EpocheGuard epocheGuard(threadEpocheInfo);
 restart:
@@ -1668,12 +3693,12 @@ restart:
                 return;
             }
 
-            Pair *offset_pair = &node->pairs[0];
-            Pair *move_pair = &node->pairs[maxPairsLength];
-            uint64_t midkey = node -> midkey[0];
+            PairPtr offset_pair = node->half(0);
+            PairPtr move_pair = node->half(1);
+            Key midkey = node -> midkey[0];
             if (versionTurn(header))
             {
-                Pair *temp = offset_pair;
+                PairPtr temp = offset_pair;
                 offset_pair = move_pair;
                 move_pair = temp;
                 midkey = node -> midkey[1];
@@ -1684,7 +3709,7 @@ restart:
             int lazyflag = (header >> shiflazybox) & 3;
             Pair lazybox = node->LazyBox;
 
-            int oldend = getNum(header) - 1 - lazydiff[lazyflag];
+            int oldend = getNum(header) - 1 - lazydiff[lazyflag] - getExtra(header);
             Pair upPair;
 
             int k = 0;
@@ -1694,7 +3719,7 @@ restart:
 
             if (k == 0)
             {
-                upPair.key = 0;
+                upPair.key = KeyTraits::minKey;
                 nextoid.oid.off = upPair.value = 0;
             }
             else
@@ -1705,11 +3730,11 @@ restart:
 
             k--;
             //compare with lazybox
-            uint64_t succKey = node -> maxKey[rightTurn(header)];
+            Key succKey = node -> maxKey[rightTurn(header)];
 
             if (k < oldend )
             {
-                uint64_t nextKey =  offset_pair[k + 1].key;
+                Key nextKey =  offset_pair[k + 1].key;
                 if (lazyflag == 0x2  && lazybox.key == nextKey)
                 {
                     if (k + 1 < oldend)
@@ -1724,7 +3749,7 @@ restart:
                 if (k > 0)  nextoid.oid.off = offset_pair[k - 1].value;
                 else
                 {
-                    upPair.key = 0;
+                    upPair.key = KeyTraits::minKey;
                     nextoid.oid.off = upPair.value = 0;
                 }
             }
@@ -1733,8 +3758,7 @@ restart:
             {
                 if (lazybox.key <= minscan && lazybox.key >= upPair.key)
                 {
-                    uint64_t v = reinterpret_cast<uint64_t>(lazybox.value);
-                    upPair.value = nextoid.oid.off = signextend(v);
+                    upPair.value = nextoid.oid.off = lazybox.value;
                     upPair.key = lazybox.key;
                 }
                 if (lazybox.key > minscan && lazybox.key <= succKey)
@@ -1756,11 +3780,11 @@ restart:
             TOID(Node) iteratoroid = nextoid;
             Node *iterator = D_RW(nextoid);
             uint32_t sum = 0;
-            uint64_t node_upper = node->maxKey[rightTurn(header)];
+            Key node_upper = node->maxKey[rightTurn(header)];
             uint64_t htd = iterator->header;
             temp.oid.off = iterator->right[rightTurn(htd)];
-            sum += getNum(htd) + getNum(D_RW(temp)->header);
-            if ( sum < Lnum && succKey != (uint64_t) - 1 && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper) )
+            sum += getLoad(htd) + getLoad(D_RW(temp)->header);
+            if ( sum < Lnum && succKey != KeyTraits::maxKey && !(iterator->maxKey[rightTurn(htd)] == succKey && succKey == node_upper) )
             {
                 if (succKey != node_upper && iterator->maxKey[rightTurn(htd)] == succKey)
                 {
@@ -1784,7 +3808,7 @@ restart:
             while (iterator->maxKey[rightTurn(htd)] < minscan)
             {
                 iteratoroid.oid.off = iterator->right[rightTurn(htd)];
-                sum += getNum(iterator->header);
+                sum += getLoad(iterator->header);
                 upPair.key =  iterator->maxKey[rightTurn(htd)];
                 upPair.value =  iteratoroid.oid.off;
                 //if (iterator->maxKey[rightTurn(htd)]<minscan)
@@ -1797,7 +3821,7 @@ restart:
 
 
             }
-            sum += getNum(htd);
+            sum += getLoad(htd);
             // No need to up
             if (sum <= Rnum )
             {
@@ -1856,6 +3880,398 @@ WriteProcess:
         }
     }
 
+#if defined(NARROW_INNER) || defined(ORDER_STATS)
+    static constexpr int innerEntries = innerPairsLength + 1;
+#else
+    static constexpr int innerEntries = maxPairsLength + 1;
+#endif
+    //levels a counting pass records on its way down
+    static constexpr int maxHeight = 32;
+
+    //pairs[0..n-1] up to key
+    static inline int upper_rank(const Pair *pairs, int n, const Key &key)
+    {
+        return std::upper_bound(pairs, pairs + n, key, [](const Key &k, const Pair &p)
+        {
+            return k < p.key;
+        }) - pairs;
+    }
+
+    //the entries of an inner node in key order: the LazyBox in its slot, a lazily removed entry left out
+    static inline int inner_pairs(Node *node, uint64_t header, Pair *pairs)
+    {
+        int lazyflag = (header >> shiflazybox) & 3;
+        int num = getNum(header) - lazydiff[lazyflag];
+        PairPtr offset_pair = node->half(versionTurn(header));
+        int w = lazyflag ? std::min((int)node->lazyPosition, num) : -1;
+        int n = 0;
+        for (int i = 0; i < w; i++)
+            pairs[n++] = offset_pair[i];
+        if (lazyflag == 1)
+            pairs[n++] = node->LazyBox;
+        if (lazyflag != 1) w++;
+        for (int i = w; i < num; i++)
+            pairs[n++] = offset_pair[i];
+        return n;
+    }
+
+    int64_t SSBTree::nodeCount(Node *node, uint64_t header)
+    {
+        //the pairs of a merged node live on in its left sibling
+        if (isObsolete(header))
+            return 0;
+        if (isBottom(header))
+            return getNum(header);
+        Pair pairs[innerEntries];
+        uint64_t counts[innerEntries];
+        int n = entryCounts(node, header, pairs, counts);
+        if (n < 0)
+            return -1;
+        int64_t sum = 0;
+        for (int i = 0; i < n; i++)
+            sum += counts[i];
+        return sum;
+    }
+
+    uint64_t SSBTree::nodeCount(Node *node)
+    {
+        while (true)
+        {
+            int64_t sum = nodeCount(node, node->header);
+            if (sum >= 0)
+                return sum;
+        }
+    }
+
+    //children an entryCounts pass checks again before it stores the counts
+    static constexpr int countedChildren = 2 * innerEntries;
+
+    //The counts of an inner node are taken from its children and stored with a stamp of the run and
+    //the header they belong to. A separator promoted or demoted by upKey/downKey, like any rewrite of
+    //the node, changes the header and retires them; the next query or counting pass takes them again.
+    int SSBTree::entryCounts(Node *node, uint64_t header, Pair *pairs, uint64_t *counts)
+    {
+#ifdef ORDER_STATS
+        //taken before the children are read: a delta added or counts stored meanwhile may be missing below
+        uint32_t seq = node->countSeq;
+        std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+        int n = inner_pairs(node, header, pairs);
+#ifdef ORDER_STATS
+        uint64_t stamp = (uint64_t)countRun << 32 | header >> 32;
+        if (node->countStamp == stamp)
+        {
+            for (int i = 0; i < n; i++)
+                counts[i] = node->counts[i];
+            if (node->countStamp == stamp && node->header >> 32 == header >> 32)
+                return n;
+        }
+#endif
+        if (node->header >> 32 != header >> 32)
+            return -1;
+        //an entry covers its child and the nodes right of it up to the next separator. Each child is
+        //counted as of the header its right link is read at; a split or merge between two children
+        //moves pairs past the walk, so the counts are only stored if no child changed meanwhile
+        Node *children[countedChildren];
+        uint64_t childHeaders[countedChildren];
+        int nchildren = 0;
+        bool settled = true;
+        for (int i = 0; i < n; i++)
+        {
+            Key bound = i + 1 < n ? pairs[i + 1].key : node->maxKey[rightTurn(header)];
+            TOID(Node) childoid = tailoid;
+            childoid.oid.off = pairs[i].value;
+            counts[i] = 0;
+            while (childoid.oid.off != tailoid.oid.off)
+            {
+                Node *child = D_RW(childoid);
+                uint64_t childHeader = child->header;
+                int64_t count = nodeCount(child, childHeader);
+                if (count < 0)
+                {
+                    settled = false;
+                    count = nodeCount(child);
+                }
+                counts[i] += count;
+                if (nchildren < countedChildren)
+                {
+                    children[nchildren] = child;
+                    childHeaders[nchildren++] = childHeader;
+                }
+                else
+                    settled = false;
+                if (child->maxKey[rightTurn(childHeader)] >= bound)
+                    break;
+                childoid.oid.off = child->right[rightTurn(childHeader)];
+            }
+        }
+        if (node->header >> 32 != header >> 32)
+            return -1;
+        //in-place value updates leave the counts alone
+        for (int i = 0; i < nchildren && settled; i++)
+            settled = ((children[i]->header ^ childHeaders[i]) & ~UPDATE_BITS) == 0;
+#ifdef ORDER_STATS
+        //stored under the node lock, so no writer rewrites the node or adds to the counts meanwhile;
+        //skipped if it is taken or the counts changed since the walk began. The tick is taken after
+        //the children were read, see countKey
+        if (settled && pmemobj_mutex_trylock(pop, &node->mutex) == 0)
+        {
+            if (node->header >> 32 == header >> 32 && node->countSeq == seq)
+            {
+                node->countSeq = seq + 1;
+                node->countStamp = 0;
+                std::atomic_thread_fence(std::memory_order_release);
+                for (int i = 0; i < n; i++)
+                    node->counts[i] = counts[i];
+                node->countTick = countClock.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_release);
+                node->countStamp = stamp;
+            }
+            pmemobj_mutex_unlock(pop, &node->mutex);
+        }
+#endif
+        return n;
+    }
+
+#ifdef ORDER_STATS
+    inline uint64_t SSBTree::countSince()
+    {
+        return countClock.load();
+    }
+
+    //Runs once the write is done, so counts taken again on the way already see it. The path is
+    //recorded top-down and counted bottom-up, so that a parent whose counts are taken again reads
+    //children that were brought up to date. Each node is counted under its lock, by its header then:
+    //a split meanwhile sends key right, to the node that holds it now. Counts stored with a tick below
+    //since read the children before the write began and get delta; newer ones may hold the write
+    //already and are retired instead, to be taken again. Either way the sequence of the node moves,
+    //so a counting pass that read the children before this write does not store over it. A level
+    //grown over the path meanwhile is counted too.
+    void SSBTree::countKey(const Key &key, int delta, uint64_t since)
+    {
+        Node *path[maxHeight];
+        Pair pairs[innerEntries];
+        uint64_t counts[innerEntries];
+        int depth, done = 0;
+        uint64_t top;
+restart:
+        depth = 0;
+        top = rootoid.oid.off;
+        TOID(Node) nodeoid = rootoid;
+        while (depth < maxHeight)
+        {
+            Node *node = D_RW(nodeoid);
+            uint64_t header = node->header;
+            if (node->maxKey[rightTurn(header)] <= key)
+            {
+                nodeoid.oid.off = node->right[rightTurn(header)];
+                if (!Node::RightCheck(node->header, header))
+                    goto restart;
+                continue;
+            }
+            if (isBottom(header))
+                break;
+            int n = inner_pairs(node, header, pairs);
+            if (node->header >> 32 != header >> 32)
+                continue;
+            path[depth++] = node;
+            nodeoid.oid.off = pairs[std::max(upper_rank(pairs, n, key) - 1, 0)].value;
+        }
+        //the levels below the ones counted by an earlier pass
+        for (int d = depth - done - 1; d >= 0; d--)
+        {
+            Node *node = path[d];
+            bool counted;
+            while (true)
+            {
+                pmemobj_mutex_lock(pop, &node->mutex);
+                uint64_t header = node->header;
+                if (!isObsolete(header) && node->maxKey[rightTurn(header)] <= key)
+                {
+                    TOID(Node) rightoid = tailoid;
+                    rightoid.oid.off = node->right[rightTurn(header)];
+                    pmemobj_mutex_unlock(pop, &node->mutex);
+                    node = D_RW(rightoid);
+                    continue;
+                }
+                uint64_t stamp = (uint64_t)countRun << 32 | header >> 32;
+                //a merged node left its pairs to its left sibling, which the merge rewrote
+                if (isObsolete(header))
+                    counted = true;
+                else if (node->countStamp != stamp)
+                    counted = false;
+                else if (node->countTick < since)
+                {
+                    int n = inner_pairs(node, header, pairs);
+                    int entry = std::max(upper_rank(pairs, n, key) - 1, 0);
+                    __atomic_fetch_add(&node->counts[entry], (uint32_t)delta, __ATOMIC_RELAXED);
+                    counted = true;
+                }
+                else
+                {
+                    node->countStamp = 0;
+                    counted = false;
+                }
+                node->countSeq = node->countSeq + 1;
+                pmemobj_mutex_unlock(pop, &node->mutex);
+                break;
+            }
+            if (!counted)
+                entryCounts(node, node->header, pairs, counts);
+        }
+        done = std::max(done, depth);
+        if (rootoid.oid.off != top)
+            goto restart;
+    }
+#else
+    inline uint64_t SSBTree::countSince()
+    {
+        return 0;
+    }
+    inline void SSBTree::countKey(const Key &, int, uint64_t) {}
+#endif
+
+    uint64_t SSBTree::rankOf(const Key x, bool inclusive)
+    {
+        Pair pairs[std::max<int>(innerEntries, leafPairsLength)];
+        uint64_t counts[innerEntries];
+restart:
+        uint64_t rank = 0;
+        TOID(Node) nodeoid = rootoid;
+        while (nodeoid.oid.off != tailoid.oid.off)
+        {
+            Node *node = D_RW(nodeoid);
+            uint64_t header = node->header;
+            //the keys of the node are below its maxKey; a duplicate put may leave one equal to it
+            Key maxKey = node->maxKey[rightTurn(header)];
+            if (maxKey < x || (inclusive && maxKey == x))
+            {
+                rank += nodeCount(node);
+                nodeoid.oid.off = node->right[rightTurn(header)];
+                if (!Node::RightCheck(node->header, header))
+                    goto restart;
+                continue;
+            }
+            if (isBottom(header))
+            {
+                int n = leaf_pairs(node, header, KeyTraits::minKey, x, pairs);
+                if (!Node::ReadcheckVesion(header, node->header))
+                    continue;
+                if (!inclusive)
+                    n = lower_rank(pairs, n, x);
+                return rank + n;
+            }
+            int n = entryCounts(node, header, pairs, counts);
+            if (n < 0)
+                continue;
+            int entry = std::max(upper_rank(pairs, n, x) - 1, 0);
+            for (int i = 0; i < entry; i++)
+                rank += counts[i];
+            nodeoid.oid.off = pairs[entry].value;
+        }
+        return rank;
+    }
+
+    uint64_t SSBTree::rank(const Key key, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        uint64_t below = rankOf(key, false);
+        //the reserved minKey is below every key
+        return below > 0 ? below - 1 : 0;
+    }
+
+    bool SSBTree::select(uint64_t i, Pair &result, ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        Pair pairs[std::max<int>(innerEntries, leafPairsLength)];
+        uint64_t counts[innerEntries];
+restart:
+        uint64_t rest = i + 1; //past the reserved minKey
+        TOID(Node) nodeoid = rootoid;
+        while (nodeoid.oid.off != tailoid.oid.off)
+        {
+            Node *node = D_RW(nodeoid);
+            uint64_t header = node->header;
+            if (isBottom(header))
+            {
+                int n = leaf_pairs(node, header, KeyTraits::minKey, KeyTraits::maxKey, pairs);
+                if (!Node::ReadcheckVesion(header, node->header))
+                    continue;
+                if (rest < (uint64_t)n)
+                {
+                    result = pairs[rest];
+                    return true;
+                }
+                rest -= n;
+            }
+            else
+            {
+                int n = entryCounts(node, header, pairs, counts);
+                if (n < 0)
+                    continue;
+                int entry = 0;
+                while (entry < n && rest >= counts[entry])
+                    rest -= counts[entry++];
+                if (entry < n)
+                {
+                    nodeoid.oid.off = pairs[entry].value;
+                    continue;
+                }
+            }
+            //counts taken while writers run may fall short: go on with the next node of the level
+            nodeoid.oid.off = node->right[rightTurn(header)];
+            if (!Node::RightCheck(node->header, header))
+                goto restart;
+        }
+        return false;
+    }
+
+    uint64_t SSBTree::countRange(const Key minscan, const Key maxscan, ThreadInfo &threadEpocheInfo)
+    {
+        if (maxscan < minscan)
+            return 0;
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        uint64_t upto = rankOf(maxscan, true);
+        uint64_t below = rankOf(minscan, false);
+        if (minscan == KeyTraits::minKey && upto > 0)
+            upto--;
+        return upto > below ? upto - below : 0;
+    }
+
+    NodeStats SSBTree::nodeStats(ThreadInfo &threadEpocheInfo)
+    {
+        EpocheGuard epocheGuard(threadEpocheInfo);
+        NodeStats stats;
+        TOID(Node) leveloid = headoid;
+        while (true)
+        {
+            Node *level = D_RW(leveloid);
+            uint64_t levelHeader = level->header;
+            for (TOID(Node) nodeoid = leveloid; nodeoid.oid.off != tailoid.oid.off;)
+            {
+                Node *node = D_RW(nodeoid);
+                uint64_t header = node->header;
+                uint64_t capacity = isCompact(header) ? compactPairsLength : pairsLength(header);
+                if (isBottom(header))
+                {
+                    stats.bottomNodes++;
+                    stats.bottomPairs += getNum(header);
+                    stats.bottomCapacity += capacity;
+                }
+                else
+                {
+                    stats.innerNodes++;
+                    stats.innerPairs += getNum(header);
+                    stats.innerCapacity += capacity;
+                }
+                nodeoid.oid.off = node->right[rightTurn(header)];
+            }
+            if (isBottom(levelHeader)) break;
+            //the first pair of a level head is the minKey separator to the head of the level below
+            leveloid.oid.off = level->half(versionTurn(levelHeader))[0].value;
+        }
+        return stats;
+    }
 }
 
 
@@ -10,7 +10,13 @@
 #include <stdint.h>
 #include <libpmemobj.h>
 #include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+#include <type_traits>
 #include "Epoche.h"
+#include "ValueLog.h"
 namespace thu_ltl
 {
     class Node;
@@ -20,19 +26,300 @@ namespace thu_ltl
     POBJ_LAYOUT_TOID(thu_ltl, Node);
     POBJ_LAYOUT_END(thu_ltl);
     typedef uint64_t Oidoff;
-    struct Pair //16bytes
+
+#ifndef KEY_BITS
+#define KEY_BITS 64
+#endif
+#ifdef STRING_KEY
+    //caller-owned bytes of a variable-length key
+    struct KeyView
+    {
+        const char *data;
+        uint32_t len;
+    };
+
+    //A variable-length key: nodes hold an 8-byte prefix and a reference to the full bytes.
+    //Comparisons only dereference the full bytes when the prefixes tie.
+    struct StringKey
     {
-        uint64_t key;
+        uint64_t prefix; //first 8 bytes, big-endian and zero padded
+        uint64_t ref;    //pool offset of a stored key (uint32_t len, then the bytes), a KeyView address | transientBit, or 0 for the sentinels
+
+        static constexpr uint64_t transientBit = 1ULL << 63;
+        static inline char *poolBase = nullptr; //one string-keyed pool per process
+
+        StringKey() = default;
+        constexpr StringKey(uint64_t p, uint64_t r) : prefix(p), ref(r) {}
+        //wraps the bytes for the duration of a call; put() copies them into the pool
+        explicit StringKey(const KeyView &v) : prefix(loadPrefix(v.data, v.len)), ref((uint64_t)&v | transientBit) {}
+
+        static inline uint64_t loadPrefix(const char *data, uint32_t len)
+        {
+            uint64_t p = 0;
+            for (uint32_t i = 0; i < 8; i++)
+                p = (p << 8) | (i < len ? (uint8_t)data[i] : 0);
+            return p;
+        }
+        bool isTransient() const
+        {
+            return ref & transientBit;
+        }
+        KeyView view() const
+        {
+            if (isTransient())
+                return *(const KeyView *)(ref ^ transientBit);
+            const char *stored = poolBase + ref;
+            return KeyView{stored + sizeof(uint32_t), *(const uint32_t *)stored};
+        }
+        static int compare(const StringKey &a, const StringKey &b)
+        {
+            if (a.prefix != b.prefix) return a.prefix < b.prefix ? -1 : 1;
+            if (a.ref == b.ref) return 0;
+            if (!a.ref) return a.prefix ? 1 : -1;
+            if (!b.ref) return b.prefix ? -1 : 1;
+            KeyView x = a.view(), y = b.view();
+            uint32_t n = x.len < y.len ? x.len : y.len;
+            int c = n > 8 ? memcmp(x.data + 8, y.data + 8, n - 8) : 0;
+            if (c) return c;
+            return x.len < y.len ? -1 : x.len > y.len;
+        }
+        bool operator==(const StringKey &o) const
+        {
+            return prefix == o.prefix && (ref == o.ref || compare(*this, o) == 0);
+        }
+        bool operator!=(const StringKey &o) const
+        {
+            return !(*this == o);
+        }
+        bool operator<(const StringKey &o) const
+        {
+            return prefix != o.prefix ? prefix < o.prefix : compare(*this, o) < 0;
+        }
+        bool operator>(const StringKey &o) const
+        {
+            return o < *this;
+        }
+        bool operator<=(const StringKey &o) const
+        {
+            return !(o < *this);
+        }
+        bool operator>=(const StringKey &o) const
+        {
+            return !(*this < o);
+        }
+    };
+    typedef StringKey Key;
+    struct KeyTraits
+    {
+        static constexpr Key minKey = Key(0, 0);          //reserved by the head nodes
+        static constexpr Key maxKey = Key(~0ULL, 0);      //reserved by the tail node
+        //only the prefix is hashed, so a stored key and its transient copy agree
+        static inline uint64_t hash(Key key)
+        {
+            return key.prefix * 0x9E3779B97F4A7C15ULL;
+        }
+    };
+#else
+    //keys are fixed-width unsigned integers compared with the builtin operators.
+    //A composite key packs its fields most significant first, see makeKey.
+#if KEY_BITS == 32
+    typedef uint32_t Key;
+#elif KEY_BITS == 64
+    typedef uint64_t Key;
+#elif KEY_BITS == 128
+    typedef unsigned __int128 Key;
+    static inline Key makeKey(uint64_t high, uint64_t low)
+    {
+        return ((Key)high << 64) | low;
+    }
+#else
+#error "KEY_BITS should be 32, 64 or 128"
+#endif
+    struct KeyTraits
+    {
+        static constexpr Key minKey = 0;          //reserved by the head nodes
+        static constexpr Key maxKey = (Key) - 1;  //reserved by the tail node
+        //spreads the key bits over the top byte for fingerprints
+        static inline uint64_t hash(Key key)
+        {
+#if KEY_BITS == 128
+            return ((uint64_t)key ^ (uint64_t)(key >> 64)) * 0x9E3779B97F4A7C15ULL;
+#else
+            return (uint64_t)key * 0x9E3779B97F4A7C15ULL;
+#endif
+        }
+    };
+#endif
+
+    struct Pair //16bytes for 64-bit keys
+    {
+        Key key;
         Oidoff value;
     };
 
-    static  constexpr uint32_t maxPairsLength = 35;
-    static  constexpr uint32_t NodeSize = 1280;
-    static  constexpr uint32_t highPosition = 50;
-    static  constexpr int midindex = 23;
-    static_assert((maxPairsLength + 5) * 32 == NodeSize, "NodeSize should match maxPairsLength");
-    static_assert(highPosition >= 48, "cacnonical addreses at least 48 bit.");
-    static_assert(exp2(64 - highPosition) > 15, "length should smaller than Noncanonical addresses ");
+#if defined(NARROW_INNER) && !defined(SOA_LAYOUT)
+#error "NARROW_INNER needs SOA_LAYOUT"
+#endif
+
+    //nodes come from a 256-byte aligned alloc class, so inner nodes address a child by off >> nodeAlignShift
+    static  constexpr uint32_t nodeAlignShift = 8;
+
+#ifdef NARROW_INNER
+    //the value of a pair: an Oidoff in bottom nodes, a 32-bit node index in inner nodes
+    struct ValueRef
+    {
+        Oidoff *wide;
+        uint32_t *narrow;
+        operator Oidoff() const
+        {
+            return narrow ? (Oidoff) * narrow << nodeAlignShift : *wide;
+        }
+        ValueRef &operator=(Oidoff v)
+        {
+            if (narrow) *narrow = v >> nodeAlignShift;
+            else *wide = v;
+            return *this;
+        }
+        ValueRef &operator=(const ValueRef &v)
+        {
+            return *this = (Oidoff)v;
+        }
+        //only bottom nodes hand out the address of a value
+        Oidoff *operator&() const
+        {
+            return wide;
+        }
+    };
+#endif
+
+#ifdef SOA_LAYOUT
+    //a pair stored across the key array and the value array of a half
+    struct PairRef
+    {
+        Key &key;
+#ifdef NARROW_INNER
+        ValueRef value;
+#else
+        Oidoff &value;
+#endif
+        PairRef &operator=(const Pair &p)
+        {
+            key = p.key;
+            value = p.value;
+            return *this;
+        }
+        PairRef &operator=(const PairRef &p)
+        {
+            key = p.key;
+            value = p.value;
+            return *this;
+        }
+        operator Pair() const
+        {
+            return Pair{key, value};
+        }
+    };
+    //points into one version half: keys[] and values[] advance together
+#ifdef NARROW_INNER
+    //exactly one of values and children is set, by the kind of node
+    struct PairPtr
+    {
+        Key *keys;
+        Oidoff *values;
+        uint32_t *children;
+        PairRef operator[](int i) const
+        {
+            return children ? PairRef{keys[i], ValueRef{nullptr, children + i}} : PairRef{keys[i], ValueRef{values + i, nullptr}};
+        }
+        PairPtr operator+(int i) const
+        {
+            return children ? PairPtr{keys + i, nullptr, children + i} : PairPtr{keys + i, values + i, nullptr};
+        }
+        PairPtr operator-(int i) const
+        {
+            return *this + (-i);
+        }
+    };
+#else
+    struct PairPtr
+    {
+        Key *keys;
+        Oidoff *values;
+        PairRef operator[](int i) const
+        {
+            return PairRef{keys[i], values[i]};
+        }
+        PairPtr operator+(int i) const
+        {
+            return PairPtr{keys + i, values + i};
+        }
+        PairPtr operator-(int i) const
+        {
+            return PairPtr{keys - i, values - i};
+        }
+    };
+#endif
+#else
+    typedef Pair *PairPtr;
+#endif
+
+#ifndef NODE_SIZE
+#define NODE_SIZE 1280
+#endif
+#ifndef LAZYBOX_SLOTS
+#define LAZYBOX_SLOTS 1
+#endif
+    //node geometry is fixed at compile time; NODE_SIZE should be a multiple of the 256-byte XPLine
+    static  constexpr uint32_t NodeSize = NODE_SIZE;
+    //pending inserts a bottom node absorbs before the copy-on-write: the LazyBox and LAZYBOX_SLOTS - 1 extra boxes
+    static  constexpr uint32_t lazySlots = LAZYBOX_SLOTS;
+    static_assert(lazySlots >= 1 && lazySlots <= 4, "LAZYBOX_SLOTS should be 1 to 4");
+    //header fields: header, lazyPosition, LazyBox, midkey[2], maxKey[2], right[2] and the extra boxes (80 bytes for 64-bit keys and one slot)
+    static  constexpr uint32_t nodeHeadSize = 32 + lazySlots * sizeof(Pair) + 4 * sizeof(Key);
+#ifdef SOA_LAYOUT
+    static  constexpr uint32_t pairBytes = sizeof(Key) + sizeof(Oidoff);
+#else
+    static  constexpr uint32_t pairBytes = sizeof(Pair);
+#endif
+    //bytes after the header fields and before the mutex (64)
+    static  constexpr uint32_t nodeBodySize = NodeSize - nodeHeadSize - 64;
+#ifdef FINGERPRINT
+    //each pair of a half also needs a fingerprint byte
+    static  constexpr uint32_t maxPairsLength = (nodeBodySize - 8) / (2 * pairBytes + 2);
+    static  constexpr uint32_t fingerprintLength = (maxPairsLength + 3) & ~3u; //per half, both halves padded to 8 bytes
+#else
+    static  constexpr uint32_t maxPairsLength = (nodeBodySize - 16) / (2 * pairBytes);
+#endif
+    //compact bottom nodes keep one pair array and double-buffer only the slot order
+    static  constexpr uint32_t compactSlotsRound(uint32_t n)
+    {
+        return (n + alignof(Pair) - 1) & ~(uint32_t)(alignof(Pair) - 1);
+    }
+    static  constexpr uint32_t compactFit(uint32_t n)
+    {
+        return 2 * compactSlotsRound(n) + sizeof(Pair) * n <= nodeBodySize ? n : compactFit(n - 1);
+    }
+    static  constexpr uint32_t compactPairsLength = compactFit(nodeBodySize / sizeof(Pair) < 63 ? nodeBodySize / sizeof(Pair) : 63);
+    static  constexpr uint32_t compactSlotsLength = compactSlotsRound(compactPairsLength);
+#if defined(NARROW_INNER) || defined(ORDER_STATS)
+#ifdef NARROW_INNER
+    //inner nodes store a key and a 4-byte child per entry
+    static  constexpr uint32_t innerPairBytes = sizeof(Key) + sizeof(uint32_t);
+#else
+    static  constexpr uint32_t innerPairBytes = pairBytes;
+#endif
+#ifdef ORDER_STATS
+    //inner nodes also count the pairs under each entry, after a stamp, a tick and a sequence; bottom nodes keep the whole body
+    static  constexpr uint32_t innerPairsLength = (nodeBodySize - 32) / (2 * innerPairBytes + 4);
+#else
+    static  constexpr uint32_t innerPairsLength = nodeBodySize / (2 * innerPairBytes);
+#endif
+#endif
+    static  constexpr int midindex = maxPairsLength * 2 / 3;
+    //pairs a bottom node of either format can hand to a scan
+    static  constexpr uint32_t leafPairsLength = (maxPairsLength > compactPairsLength ? maxPairsLength : compactPairsLength) + lazySlots;
+    static_assert(NodeSize % 256 == 0, "nodes are allocated in units of 256 bytes");
+    static_assert(maxPairsLength >= 3, "a node should hold at least three pairs");
 
 
     class  Node
@@ -43,24 +330,126 @@ namespace thu_ltl
         // version(16bit) number(16bit)
         // Lazyboxflag(2bit) bottomflag(1bit) Obsolete(1bit)
         // Right(2bit) mutex(2bit)
-        // reserve(24bit)
+        // compactflag(1bit) extraboxes(2bit) updates(21bit)
         /********************/
         volatile uint64_t header;//8Byte
-        uint64_t dummy;  //8Byte
-        Pair LazyBox;           //16Bytes
-        uint64_t midkey[2]; // 16Bytes
-        volatile uint64_t maxKey[2];   //16Bytes
+        uint64_t lazyPosition;  //8Byte, slot of the LazyBox pair in the current half
+        Pair LazyBox;           //a pair, its value is kept whole
+        Key midkey[2]; // 2 keys
+#ifdef STRING_KEY
+        Key maxKey[2];   //2 keys
+#else
+        volatile Key maxKey[2];   //2 keys
+#endif
         volatile Oidoff right[2];       //16bytes
-        Pair pairs[2 * maxPairsLength];
-        uint64_t dummy2[2];
+#if LAZYBOX_SLOTS > 1
+        Pair extraBox[LAZYBOX_SLOTS - 1]; //more pending inserts, kept unsorted
+#endif
+        union
+        {
+            struct
+            {
+#ifdef FINGERPRINT
+                uint8_t fingerprints[2][fingerprintLength]; //one hashed byte per key of bottom nodes
+#endif
+#ifdef SOA_LAYOUT
+                struct
+                {
+                    Key keys[maxPairsLength];
+                    Oidoff values[maxPairsLength];
+                } halves[2];
+#else
+                Pair pairs[2 * maxPairsLength];
+#endif
+            };
+            struct
+            {
+                uint8_t slots[2][compactSlotsLength]; //sorted order of pairs
+                Pair pairs[compactPairsLength];
+            } compact;
+#if defined(NARROW_INNER) || defined(ORDER_STATS)
+            struct
+            {
+                struct
+                {
+#ifdef NARROW_INNER
+                    Key keys[innerPairsLength];
+                    uint32_t children[innerPairsLength];
+#elif defined(SOA_LAYOUT)
+                    Key keys[innerPairsLength];
+                    Oidoff values[innerPairsLength];
+#else
+                    Pair pairs[innerPairsLength];
+#endif
+                } inner[2];
+#ifdef ORDER_STATS
+                volatile uint64_t countStamp;   //the run and header >> 32 the counts belong to, see SSBTree::entryCounts
+                volatile uint64_t countTick;    //SSBTree::countClock when the counts were stored
+                volatile uint32_t countSeq;     //bumped under the node lock by every change to the counts
+                uint32_t counts[innerPairsLength + 1];  //pairs under each entry, in key order
+#endif
+            };
+#endif
+            uint8_t body[nodeBodySize]; //keeps the mutex at the end of the node
+        };
         PMEMmutex mutex;   // 64 bytes
     public:
+        inline PairPtr half(int turn) __attribute__((always_inline));
         static inline void addRight(uint64_t &header) __attribute__((always_inline));
         static inline bool ReadcheckVesion(uint64_t ol, uint64_t ne) __attribute__((always_inline));
         static inline bool WritecheckVesion(uint64_t ol, uint64_t ne) __attribute__((always_inline));
         static inline bool RightCheck(uint64_t ol, uint64_t ne) __attribute__((always_inline));
         static inline void clflush(PMEMobjpool *pop, char *data, int len, bool front, bool back) __attribute__((always_inline));
     };
+    static_assert(sizeof(Node) == NodeSize, "Node layout should fill NodeSize exactly");
+    static_assert(compactPairsLength < 64, "free compact slots are tracked in a 64-bit mask");
+#if defined(NARROW_INNER) || defined(ORDER_STATS)
+    static_assert(sizeof(Node::inner) <= nodeBodySize, "inner halves should fit in a node");
+#endif
+#ifdef NARROW_INNER
+    static_assert(innerPairsLength >= maxPairsLength, "inner nodes should not hold fewer entries");
+#endif
+
+    //pairs held and pair capacity of the reachable nodes
+    struct NodeStats
+    {
+        uint64_t bottomNodes = 0, bottomPairs = 0, bottomCapacity = 0;
+        uint64_t innerNodes = 0, innerPairs = 0, innerCapacity = 0;
+    };
+
+    //count, sum, smallest and largest value of a key range; the sum wraps around at 2^64
+    struct Aggregate
+    {
+        uint64_t count = 0, sum = 0;
+        uint64_t min = ~0ULL, max = 0;
+    };
+
+    //one mutation of SSBTree::applyBatch
+    struct Op
+    {
+        Key key;
+        uint64_t value;
+        bool remove;
+    };
+
+    //a node being written by a bulk load, and the first node of its level
+    struct BulkLevel
+    {
+        Node *node;
+        uint64_t off;
+        uint64_t head;
+        int num;
+    };
+
+#ifdef FINGER_CACHE
+    //the bottom node of the previous operation of a thread; low is a key inside its range
+    struct Finger
+    {
+        uint64_t leaf = 0;
+        uint64_t freed = 0;
+        Key low;
+    };
+#endif
 
     class SSBTree
     {
@@ -73,25 +462,89 @@ namespace thu_ltl
         uint32_t Lnum, Rnum;
         uint64_t epocheColor;
         Epoche *epoche;
+        ValueLog *valueLog;
         PMEMobjpool *pop;
+        //volatile, reset by reStart: the bottom node holding the largest keys, and a node allocated ahead of a split
+        std::atomic<uint64_t> rightmostLeaf;
+        std::atomic<uint64_t> spareNode;
+        //persistent: the spare node while nothing links it, so that reStart frees it after a crash
+        PMEMoid spareOid;
+#ifdef ORDER_STATS
+        //persistent, bumped by every reStart: counts taken in an earlier run are never trusted
+        uint32_t countRun;
+        //volatile, reset by reStart: ticks once per stored count, to order stores against writes
+        std::atomic<uint64_t> countClock;
+#endif
+#ifdef FINGER_CACHE
+        tbb::enumerable_thread_specific<Finger> *fingers;
+#endif
     private:
 
-        int64_t signextend(const uint64_t x);
 
         Node *newNode();
-        void linear_search(int &k,  Pair *offset_pair, const int &n, const uint64_t &findkey);
-        void split(Node *node);
+        void newTail(uint64_t header);
+        Node *bulkNode(uint64_t &off, uint64_t header);
+        void bulkLevel(std::vector<BulkLevel> &levels);
+        void bulkClose(BulkLevel &level, Oidoff right, const Key &maxKey);
+        void bulkAppend(std::vector<BulkLevel> &levels, size_t level, const Pair &pair);
+        std::vector<Pair> bulkBuild(uint64_t header, uint64_t n, const std::function<Pair(uint64_t)> &entry);
+#ifdef STRING_KEY
+        Key storeKey(const Key &key);
+#endif
+        void linear_search(int &k,  PairPtr offset_pair, const int &n, const Key &findkey);
+        //the traversal of lookup, inside the epoch of the caller
+        uint64_t search(const Key findkey, TOID(Node) &leafoid, ThreadInfo &threadEpocheInfo);
+        bool readNode(Node *node, uint64_t header, const Key &findkey, bool strict, uint64_t &result, Key &low, bool &found);
+        bool update(const Key updatekey, const uint64_t updatevalue, uint64_t &old, ThreadInfo &threadEpocheInfo);
+        bool normalRemove(const Key removekey, uint64_t &old, ThreadInfo &threadEpocheInfo);
+        bool balanceRemove(const Key removekey, uint64_t &old, ThreadInfo &threadEpocheInfo);
+#ifdef FINGERPRINT
+        int fingerprint_search(const uint8_t *fingerprints, PairPtr offset_pair, const int &n, const Key &findkey);
+#endif
+        void split(Node *node, const Key &insertKey);
+        uint64_t allocNode();
+        void reserveNode();
+        //insert past the last key of the rightmost bottom node without a traversal
+        bool tryAppend(const Key insertKey, const uint64_t insertValue);
+        //start at the finger of the thread if key is in reach; no-ops without FINGER_CACHE
+        void fromFinger(TOID(Node) &nodeoid, const Key &key, bool insert);
+        void toFinger(TOID(Node) nodeoid, uint64_t header, const Key &key);
         void merge(Node *node, ThreadInfo &threadEpocheInfo);
+        //fold all boxes of a bottom node into its other half
+        uint64_t boxMerge(Node *node, uint64_t header, const Pair *insertPair, const Key *removeKey);
         //insert a k-v pair into a node
         void upKey(Node *&node, uint64_t &header, int &lazyflag, Pair &lazybox, Pair &upPair,
-                   Pair *&move_pair, Pair *&offset_pair,
+                   PairPtr &move_pair, PairPtr &offset_pair,
                    int &LessOrEqual, int &endlocation);
 
         //delete a k-v pair from a node
         void downKey(Node *&node, uint64_t &header, int &lazyflag, Pair &lazybox, Pair &downPair,
-                     Pair *&move_pair, Pair *&offset_pair,
+                     PairPtr &move_pair, PairPtr &offset_pair,
                      int &LessOrEqual, int &endlocation, ThreadInfo &threadEpocheInfo);
-        void leafscan(TOID(Node) nodeoid, const uint64_t minscan, const uint64_t maxscan, int length, uint64_t *results, int &offset);
+        //compact bottom nodes
+        void compactUpKey(Node *node, uint64_t header, Pair &upPair);
+        bool compactDownKey(Node *node, uint64_t header, const Key downkey, uint64_t &removed);
+        void compactSplit(Node *node, const Key &insertKey);
+        void compactMerge(Node *node, Node *sibling, uint64_t header, uint64_t sibling_header);
+        //apply the leading ops that fall into one bottom node with one copy-on-write
+        size_t applyLeaf(const Op *ops, size_t n, ThreadInfo &threadEpocheInfo);
+        //the pairs in [minscan, maxscan] of the bottom node nodeoid, read again until its version holds, without
+        //the reserved minKey; nodeoid moves on to the right sibling, or to the tail once maxscan is passed
+        int leafPairs(TOID(Node) &nodeoid, const Key minscan, const Key maxscan, Pair *pairs);
+        int leafAt(const Key x, bool strict, Pair *pairs, Key &low, Key &high);
+        std::vector<Key> rangeSplits(const Key minscan, const Key maxscan, size_t want);
+        //pairs under a node, and the entries of an inner node with the pairs under each; -1 if the node changed
+        uint64_t nodeCount(Node *node);
+        int64_t nodeCount(Node *node, uint64_t header);
+        int entryCounts(Node *node, uint64_t header, Pair *pairs, uint64_t *counts);
+        //pairs with keys below x, or up to x with inclusive, the reserved minKey included
+        uint64_t rankOf(const Key x, bool inclusive);
+        //the tick a write takes before it changes a bottom node, for countKey
+        uint64_t countSince();
+        //adds delta to the counts on the path of key once a write that began at tick since changed its
+        //bottom node; a no-op without ORDER_STATS
+        void countKey(const Key &key, int delta, uint64_t since);
+        void leafscan(TOID(Node) nodeoid, const Key minscan, const Key maxscan, int length, uint64_t *results, int &offset);
 
     public:
 
@@ -99,17 +552,137 @@ namespace thu_ltl
         SSBTree(uint32_t lnum, uint32_t rnum);
         ~SSBTree();
 
-        void pmdk_constructor(uint32_t lnum, uint32_t rnum);
+        void pmdk_constructor(uint32_t lnum, uint32_t rnum, bool compactLeaf = false);
+        //build a new tree from pairs in ascending key order; the reserved keys may not occur
+        void bulk_constructor(uint32_t lnum, uint32_t rnum, const std::function<bool(Pair &)> &next, bool compactLeaf = false);
+        //the same from an array, built in parallel by the TBB scheduler
+        void bulk_constructor(uint32_t lnum, uint32_t rnum, const Pair *pairs, uint64_t n, bool compactLeaf = false);
         void reStart(PMEMobjpool *setpop);
         ThreadInfo getThreadInfo();
 
-        uint64_t lookup(const uint64_t findkey, ThreadInfo &threadEpocheInfo);
-        void update(const uint64_t updatekey, const uint64_t updatevalue, ThreadInfo &threadEpocheInfo);
-        void normalRemove(const uint64_t removekey, ThreadInfo &threadEpocheInfo);
-        void balanceRemove(const uint64_t removekey, ThreadInfo &threadEpocheInfo);
-        void remove(const uint64_t removekey, ThreadInfo &threadEpocheInfo);
-        void put(const uint64_t insertKey, const uint64_t insertValue, ThreadInfo &threadEpocheInfo);
-        void scan(const uint64_t minscan, const uint64_t maxscan, int length, uint64_t *results, int &offset, ThreadInfo &threadEpocheInfo);
+        uint64_t lookup(const Key findkey, ThreadInfo &threadEpocheInfo);
+        //lookups of n keys with interleaved traversals; found[i] tells whether keys[i] is present, out[i] is 0 where not
+        void multiGet(const Key *keys, size_t n, uint64_t *out, bool *found, ThreadInfo &threadEpocheInfo);
+        //update and remove return the replaced value, 0 if the key is absent
+        uint64_t update(const Key updatekey, const uint64_t updatevalue, ThreadInfo &threadEpocheInfo);
+        uint64_t normalRemove(const Key removekey, ThreadInfo &threadEpocheInfo);
+        uint64_t balanceRemove(const Key removekey, ThreadInfo &threadEpocheInfo);
+        uint64_t remove(const Key removekey, ThreadInfo &threadEpocheInfo);
+        void put(const Key insertKey, const uint64_t insertValue, ThreadInfo &threadEpocheInfo);
+        //ops sorted by key; a put of a present key replaces its value
+        void applyBatch(const Op *ops, size_t n, ThreadInfo &threadEpocheInfo);
+
+        //variable-size values are appended to the value log and the tree holds the offset of their record
+        void put(const Key insertKey, const ValueView &value, ThreadInfo &threadEpocheInfo);
+        bool update(const Key updatekey, const ValueView &value, ThreadInfo &threadEpocheInfo);
+        bool lookup(const Key findkey, std::string &value, ThreadInfo &threadEpocheInfo);
+        bool removeValue(const Key removekey, ThreadInfo &threadEpocheInfo);
+        void scan(const Key minscan, const Key maxscan, int length, uint64_t *results, int &offset, ThreadInfo &threadEpocheInfo);
+        //the same with the key of every value, as pairs
+        void scan(const Key minscan, const Key maxscan, int length, Pair *results, int &offset, ThreadInfo &threadEpocheInfo);
+        //the pair scan as one state of the range, for exports while writers run; false if
+        //writers changed the range during each of tries attempts. In-place updates of a node wrap
+        //its 21-bit update counter after 2^21 of them, so more during one attempt may go unseen
+        bool snapshotScan(const Key minscan, const Key maxscan, int length, Pair *results, int &offset, ThreadInfo &threadEpocheInfo, int tries = 8);
+        //count, sum, min and max of the values in [minscan, maxscan], folded inside each bottom node
+        //as it is read; a node counts once its version check held, so no pair is copied out
+        Aggregate aggregate(const Key minscan, const Key maxscan, ThreadInfo &threadEpocheInfo);
+        //hands the validated pairs of each bottom node in [minscan, maxscan] to leaf(ctx, pairs, n) until it returns false
+        void scanLeaves(const Key minscan, const Key maxscan, bool (*leaf)(void *, const Pair *, int), void *ctx, ThreadInfo &threadEpocheInfo);
+        //the same from the node of maxscan down, handing each node its pairs in ascending order
+        void scanLeavesBack(const Key minscan, const Key maxscan, bool (*leaf)(void *, const Pair *, int), void *ctx, ThreadInfo &threadEpocheInfo);
+        //visitor(key, value) gets the pairs in [minscan, maxscan] in key order and returns false to stop;
+        //the pairs of a bottom node are validated before the first of them is handed out
+        template <typename Visitor>
+        void scan(const Key minscan, const Key maxscan, Visitor &&visitor, ThreadInfo &threadEpocheInfo)
+        {
+            scanLeaves(minscan, maxscan, [](void *ctx, const Pair *pairs, int n)
+            {
+                auto &visitor = *(typename std::remove_reference<Visitor>::type *)ctx;
+                for (int i = 0; i < n; i++)
+                    if (!visitor(pairs[i].key, (uint64_t)pairs[i].value))
+                        return false;
+                return true;
+            }, (void *)&visitor, threadEpocheInfo);
+        }
+        //cuts the range into parts at separator keys and scans them on nThreads TBB threads, 1 if below;
+        //leaf(ctx, part, pairs, n) gets the pairs of part in key order. Returns the number of parts
+        size_t parallelLeaves(const Key minscan, const Key maxscan, bool (*leaf)(void *, size_t, const Pair *, int), void *ctx, int nThreads);
+        //visitor(part, key, value) is called concurrently for the parts of [minscan, maxscan]. One thread
+        //visits a part in key order, and the keys of part i are below those of part i + 1, so outputs
+        //kept per part concatenate in key order. Returning false stops the part. nThreads >= 1, a smaller
+        //count runs on one thread. Returns the number of parts
+        template <typename Visitor>
+        size_t parallelScan(const Key minscan, const Key maxscan, Visitor &&visitor, int nThreads)
+        {
+            return parallelLeaves(minscan, maxscan, [](void *ctx, size_t part, const Pair *pairs, int n)
+            {
+                auto &visitor = *(typename std::remove_reference<Visitor>::type *)ctx;
+                for (int i = 0; i < n; i++)
+                    if (!visitor(part, pairs[i].key, (uint64_t)pairs[i].value))
+                        return false;
+                return true;
+            }, (void *)&visitor, nThreads);
+        }
+        //the same in descending key order
+        template <typename Visitor>
+        void reverseScan(const Key minscan, const Key maxscan, Visitor &&visitor, ThreadInfo &threadEpocheInfo)
+        {
+            scanLeavesBack(minscan, maxscan, [](void *ctx, const Pair *pairs, int n)
+            {
+                auto &visitor = *(typename std::remove_reference<Visitor>::type *)ctx;
+                for (int i = n - 1; i >= 0; i--)
+                    if (!visitor(pairs[i].key, (uint64_t)pairs[i].value))
+                        return false;
+                return true;
+            }, (void *)&visitor, threadEpocheInfo);
+        }
+
+        //A bidirectional cursor. It buffers the validated pairs of one bottom node and finds
+        //the next or previous node again from the root, so no node is kept across calls.
+        //Every node is a consistent copy; pairs written after a node was buffered may be missed.
+        class Iterator
+        {
+            SSBTree &tree;
+            ThreadInfo &threadEpocheInfo;
+            Pair pairs[leafPairsLength];
+            int n, pos;
+            Key low, high;
+
+            int load(const Key x, bool strict);
+            bool forward();
+            bool backward();
+        public:
+            Iterator(SSBTree &tree, ThreadInfo &threadEpocheInfo);
+            //move to the first pair with a key >= key, or the last pair with a key <= key
+            bool seek(const Key key);
+            bool seekForPrev(const Key key);
+            bool next();
+            bool prev();
+            bool valid() const
+            {
+                return pos >= 0 && pos < n;
+            }
+            const Key &key() const
+            {
+                return pairs[pos].key;
+            }
+            uint64_t value() const
+            {
+                return pairs[pos].value;
+            }
+        };
+
+        //order statistics over the pairs of the tree: rank is the number of keys below key, select the
+        //pair of rank i and countRange the number of keys in [minscan, maxscan]. With ORDER_STATS inner nodes
+        //keep counts per entry and a query reads O(height) nodes; without, children are counted on the way.
+        //Results are exact once the writers are done; a query racing them may see part of their writes
+        uint64_t rank(const Key key, ThreadInfo &threadEpocheInfo);
+        bool select(uint64_t i, Pair &result, ThreadInfo &threadEpocheInfo);
+        uint64_t countRange(const Key minscan, const Key maxscan, ThreadInfo &threadEpocheInfo);
+
+        //walks every level without locks; exact only while no writer runs
+        NodeStats nodeStats(ThreadInfo &threadEpocheInfo);
     };
 }
 
@@ -11,14 +11,23 @@ static inline int file_exists(char const *file)
 {
     return access(file, F_OK);
 }
-inline int64_t signextend(const uint64_t x)
+#ifdef STRING_KEY
+//the key wraps pibench's buffer until the next call on this thread
+static inline Key load_key(const char *key, size_t key_sz)
 {
-    struct
-    {
-        int64_t x: 48;
-    } s;
-    return s.x = x;
+    static thread_local KeyView view;
+    view = KeyView{key, (uint32_t)key_sz};
+    return Key(view);
+}
+#else
+//keys shorter than Key are zero-extended, longer ones are truncated
+static inline Key load_key(const char *key, size_t key_sz)
+{
+    Key k = 0;
+    memcpy(&k, key, key_sz < sizeof(Key) ? key_sz : sizeof(Key));
+    return k;
 }
+#endif
 
 SSBTree *create_new_tree_in(const tree_options_t &opt)
 {
@@ -78,7 +87,7 @@ ssbtree_wrapper::~ssbtree_wrapper()
 bool ssbtree_wrapper::find(const char *key, size_t key_sz, char *value_out)
 {
     // FIXME(tzwang): for now only support 8-byte values
-    uint64_t k = *reinterpret_cast<uint64_t *>(const_cast<char *>(key));
+    Key k = load_key(key, key_sz);
     auto t = tree_->getThreadInfo();
     uint64_t ans = tree_-> lookup(k, t);
     memcpy(value_out, &ans, sizeof(uint64_t));
@@ -88,28 +97,28 @@ bool ssbtree_wrapper::find(const char *key, size_t key_sz, char *value_out)
 bool ssbtree_wrapper::insert(const char *key, size_t key_sz, const char *value,
                              size_t value_sz)
 {
-    uint64_t k = *reinterpret_cast<uint64_t *>(const_cast<char *>(key));
+    Key k = load_key(key, key_sz);
     auto t = tree_->getThreadInfo();
     uint64_t v = *reinterpret_cast<uint64_t *>(const_cast<char *>(value));
-    tree_->put(k, signextend(v), t);
+    tree_->put(k, v, t);
     return 1;
 }
 
 bool ssbtree_wrapper::update(const char *key, size_t key_sz, const char *value,
                              size_t value_sz)
 {
-    uint64_t k = *reinterpret_cast<uint64_t *>(const_cast<char *>(key));
+    Key k = load_key(key, key_sz);
     auto t = tree_->getThreadInfo();
     uint64_t v = *reinterpret_cast<uint64_t *>(const_cast<char *>(value));
 
-    tree_->update(k, signextend(v), t);
+    tree_->update(k, v, t);
 
     return 1;
 }
 
 bool ssbtree_wrapper::remove(const char *key, size_t key_sz)
 {
-    uint64_t k = *reinterpret_cast<uint64_t *>(const_cast<char *>(key));
+    Key k = load_key(key, key_sz);
     auto t = tree_->getThreadInfo();
     tree_->remove(k, t);
     return 1;
@@ -118,10 +127,12 @@ bool ssbtree_wrapper::remove(const char *key, size_t key_sz)
 int ssbtree_wrapper::scan(const char *key, size_t key_sz, int scan_sz,
                           char *&values_out)
 {
-    static thread_local std::array < uint64_t, 100> results;
-    uint64_t k = *reinterpret_cast<uint64_t *>(const_cast<char *>(key));
+    static thread_local std::vector<Pair> results;
+    results.resize(scan_sz);
+    Key k = load_key(key, key_sz);
     auto t = tree_->getThreadInfo();
     int resultsFound = 0;
-    tree_->scan(k, UINT64_MAX, scan_sz, results.data(), resultsFound, t);
+    tree_->scan(k, KeyTraits::maxKey, scan_sz, results.data(), resultsFound, t);
+    values_out = (char *)results.data();
     return resultsFound;
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+// Copyright for SSBTree is held by the Tsinghua University
+// Licensed under the MIT license.
+// Authors:
+// Tongliang Li <onceltl@gmail.com>
+
+#include <chrono>
+#include <cstring>
+#include "ValueLog.h"
+using namespace thu_ltl;
+
+ValueLog::ValueLog(PMEMobjpool *pop, char *poolBase) : pop(pop), poolBase(poolBase)
+{
+    //segments of an earlier run keep stale live counts and are never freed by this run
+    run = std::chrono::system_clock::now().time_since_epoch().count() | 1;
+}
+
+ValueLog::Segment *ValueLog::newSegment(uint64_t size, uint64_t live)
+{
+    PMEMoid oid;
+    pmemobj_alloc(pop, &oid, size, 0, NULL, NULL);
+    Segment *segment = (Segment *)pmemobj_direct(oid);
+    segment->live.store(live, std::memory_order_relaxed);
+    segment->run = run;
+    segment->size = size;
+    pmemobj_persist(pop, segment, sizeof(Segment));
+    return segment;
+}
+
+void ValueLog::unref(Segment *segment)
+{
+    if (segment->live.fetch_sub(1) == 1)
+    {
+        PMEMoid oid = pmemobj_oid(segment);
+        pmemobj_free(&oid);
+    }
+}
+
+uint64_t ValueLog::append(const ValueView &value)
+{
+    uint64_t bytes = (sizeof(Record) + value.len + 7) & ~7ULL;
+    Segment *segment;
+    uint64_t offset = sizeof(Segment);
+    if (sizeof(Segment) + bytes > segmentSize)
+    {
+        //a value larger than a segment gets one of its own
+        segment = newSegment(sizeof(Segment) + bytes, 1);
+    }
+    else
+    {
+        Appender &appender = appenders.local();
+        if (appender.segment == nullptr || appender.used + bytes > segmentSize)
+        {
+            if (appender.segment != nullptr)
+                unref(appender.segment);
+            appender.segment = newSegment(segmentSize, 1);
+            appender.used = sizeof(Segment);
+        }
+        segment = appender.segment;
+        offset = appender.used;
+        appender.used += bytes;
+        segment->live.fetch_add(1);
+    }
+    Record *record = (Record *)((char *)segment + offset);
+    record->len = value.len;
+    record->segmentOffset = offset;
+    memcpy(record + 1, value.data, value.len);
+    pmemobj_persist(pop, record, sizeof(Record) + value.len);
+    return (char *)record - poolBase;
+}
+
+ValueView ValueLog::view(uint64_t ref) const
+{
+    Record *record = (Record *)(poolBase + ref);
+    return ValueView{(const char *)(record + 1), record->len};
+}
+
+void ValueLog::release(void *r)
+{
+    Record *record = (Record *)r;
+    Segment *segment = (Segment *)((char *)record - record->segmentOffset);
+    if (segment->run != run)
+        return;
+    unref(segment);
+}
@@ -0,0 +1,68 @@
+// Copyright for SSBTree is held by the Tsinghua University
+// Licensed under the MIT license.
+// Authors:
+// Tongliang Li <onceltl@gmail.com>
+
+#ifndef VALUELOG_H
+#define VALUELOG_H
+
+#include <atomic>
+#include <stdint.h>
+#include <libpmemobj.h>
+#include "tbb/enumerable_thread_specific.h"
+#include "Epoche.h"
+
+namespace thu_ltl
+{
+    //caller-owned bytes of a variable-size value
+    struct ValueView
+    {
+        const char *data;
+        uint32_t len;
+    };
+
+    //Append-only log of variable-size values, kept in the pool of the tree.
+    //Every thread appends to its own segment and the tree stores the pool offset of a record as the value.
+    //Superseded records go through the Epoche; a segment is freed once it is full and all of its records are released.
+    class ValueLog : public RecordReclaimer
+    {
+        struct Segment
+        {
+            std::atomic<uint64_t> live; //records not released yet, plus one while a thread appends to it
+            uint64_t run;               //live is only counted by the run that created the segment
+            uint64_t size;
+        };
+        struct Record
+        {
+            uint32_t len;
+            uint32_t segmentOffset;
+        };
+        struct Appender
+        {
+            Segment *segment = nullptr;
+            uint64_t used = 0;
+        };
+
+        PMEMobjpool *pop;
+        char *poolBase;
+        uint64_t run;
+        tbb::enumerable_thread_specific<Appender> appenders;
+
+        Segment *newSegment(uint64_t size, uint64_t live);
+        void unref(Segment *segment);
+    public:
+        static constexpr uint64_t segmentSize = 1 << 22;
+
+        ValueLog(PMEMobjpool *pop, char *poolBase);
+
+        //persists a copy of the bytes and returns the pool offset of its record
+        uint64_t append(const ValueView &value);
+        ValueView view(uint64_t ref) const;
+        void *record(uint64_t ref) const
+        {
+            return poolBase + ref;
+        }
+        void release(void *record) override;
+    };
+}
+#endif //VALUELOG_H
@@ -11,6 +11,24 @@ static inline int file_exists(char const *file)
 {
     return access(file, F_OK);
 }
+#ifdef STRING_KEY
+//"user" and 20 decimal digits: all keys tie on the 8-byte prefix
+struct ExampleKey
+{
+    char bytes[32];
+    KeyView view;
+    ExampleKey(uint64_t i)
+    {
+        view = KeyView{bytes, (uint32_t)snprintf(bytes, sizeof(bytes), "user%020lu", i)};
+    }
+    operator Key() const
+    {
+        return Key(view);
+    }
+};
+#else
+typedef Key ExampleKey;
+#endif
 void run(char **argv)
 {
     std::cout << "Simple Eample of SSBTree" << std::endl;
@@ -57,23 +75,61 @@ void run(char **argv)
         return;
     }
 
-    KV->pmdk_constructor(18, 36);
+    int stats_enabled = 1;
+    pmemobj_ctl_set(pop, "stats.enabled", &stats_enabled);
+    bool compactLeaf = argv[4] != nullptr && atoi(argv[4]) != 0;
+    bool bulkLoad = argv[4] != nullptr && argv[5] != nullptr && atoi(argv[5]) != 0;
+    //18 and 36 for 1280-byte nodes
+    uint32_t lnum = (maxPairsLength + 1) / 2, rnum = maxPairsLength + 1;
+    if (!bulkLoad)
+        KV->pmdk_constructor(lnum, rnum, compactLeaf);
+    printf("Node size: %u bytes, %u pairs\n", NodeSize, maxPairsLength);
+    printf("Threads: %d\n", num_thread);
     {
-        auto starttime = std::chrono::system_clock::now();
-        tbb::parallel_for(tbb::blocked_range<uint64_t>(0, n), [&](const tbb::blocked_range<uint64_t> &range)
+        //string keys refer to their ExampleKey, so it is built in place and never moved
+        std::vector<ExampleKey> bulkKeys;
+        std::vector<Pair> pairs;
+        if (bulkLoad)
         {
-
-            auto t = KV->getThreadInfo();
-            for (uint64_t i = range.begin(); i != range.end(); i++)
+            bulkKeys.reserve(n);
+            pairs.reserve(n);
+            for (int i = 0; i < n; i++)
             {
-                KV->put(keys[i], keys[i], t);
+                bulkKeys.emplace_back(keys[i]);
+                pairs.push_back(Pair{bulkKeys[i], keys[i]});
             }
-        });
+        }
+        auto starttime = std::chrono::system_clock::now();
+        if (bulkLoad)
+            KV->bulk_constructor(lnum, rnum, pairs.data(), n, compactLeaf);
+        else
+        {
+            tbb::parallel_for(tbb::blocked_range<uint64_t>(0, n), [&](const tbb::blocked_range<uint64_t> &range)
+            {
+
+                auto t = KV->getThreadInfo();
+                for (uint64_t i = range.begin(); i != range.end(); i++)
+                {
+                    KV->put(ExampleKey(keys[i]), keys[i], t);
+                }
+            });
+        }
         auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
                             std::chrono::system_clock::now() - starttime);
 
-        printf("Throuoghput:put,%d,%f ops/us\n", n, (n * 1.0) / duration.count());
-        printf("Elapsed time: put,%d,%f sec\n", n, duration.count() / 1000000.0);
+        const char *phase = bulkLoad ? "bulk" : "put";
+        printf("Throuoghput:%s,%d,%f ops/us\n", phase, n, (n * 1.0) / duration.count());
+        printf("Elapsed time: %s,%d,%f sec\n", phase, n, duration.count() / 1000000.0);
+
+        uint64_t allocated = 0;
+        pmemobj_ctl_get(pop, "stats.heap.curr_allocated", &allocated);
+        printf("Memory: %s,%d,%f MB\n", compactLeaf ? "compact" : "classic", n, allocated / 1048576.0);
+
+        auto t = KV->getThreadInfo();
+        NodeStats stats = KV->nodeStats(t);
+        printf("Utilization: bottom,%lu nodes,%f; inner,%lu nodes,%f\n",
+               stats.bottomNodes, (double)stats.bottomPairs / stats.bottomCapacity,
+               stats.innerNodes, (double)stats.innerPairs / std::max<uint64_t>(stats.innerCapacity, 1));
     }
 
     {
@@ -85,7 +141,7 @@ void run(char **argv)
             for (uint64_t i = range.begin(); i != range.end(); i++)
             {
                 //Keys[i] = Keys[i]->make_Key();
-                uint64_t val = KV->lookup(keys[i], t);
+                uint64_t val = KV->lookup(ExampleKey(keys[i]), t);
                 if (val != keys[i])
                 {
                     std::cout << "get wrong value: " << val << "expected : " << keys[i] << std::endl;
@@ -104,9 +160,9 @@ void run(char **argv)
 }
 int main(int argc, char **argv)
 {
-    if (argc != 4)
+    if (argc < 4 || argc > 6)
     {
-        printf("usage: %s [n] [nthreads] poolpath \n n:number of keys (integer)\nnthreads:number of threads (integer)\npoolpath:<file-name>\n", argv[0]);
+        printf("usage: %s [n] [nthreads] poolpath [compact] [bulk]\n n:number of keys (integer)\nnthreads:number of threads (integer)\npoolpath:<file-name>\ncompact:1 to create the pool with compact leaves (optional)\nbulk:1 to fill the pool with bulk_constructor instead of put (optional)\n", argv[0]);
         return 1;
     }
     run (argv);